@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONST_DIVISION (480)
+#define CONST_TEMPO (500000)
+#define CONST_CHANNEL_MAX (16)
+#define CONST_MANY_TRACKS (400)
+#define CONST_SYSEX_SIZE (65536)
+#define CONST_TEXT_SIZE (8192)
+#define CONST_ZERO_RUN (5000)
+
+typedef struct
+{
+    uint8_t* data;
+    uint32_t size;
+    uint32_t max;
+}
+Bytes;
+
+typedef struct
+{
+    Bytes* track;
+    uint16_t count;
+}
+Song;
+
+typedef struct
+{
+    char* name;
+    void (*make)(Song*);
+}
+Kind;
+
+static void
+Bytes_U8(Bytes* bytes, uint8_t byte)
+{
+    if(bytes->size == bytes->max)
+    {
+        bytes->max = bytes->max == 0 ? 1024 : 2 * bytes->max;
+        bytes->data = realloc(bytes->data, bytes->max);
+    }
+    bytes->data[bytes->size++] = byte;
+}
+
+static void
+Bytes_U16(Bytes* bytes, uint16_t word)
+{
+    Bytes_U8(bytes, word >> 8);
+    Bytes_U8(bytes, word >> 0);
+}
+
+static void
+Bytes_U32(Bytes* bytes, uint32_t word)
+{
+    Bytes_U16(bytes, word >> 16);
+    Bytes_U16(bytes, word >> 0);
+}
+
+static void
+Bytes_Var(Bytes* bytes, uint32_t var)
+{
+    uint8_t stack[5];
+    int count = 0;
+    do
+    {
+        stack[count++] = var & 0x7F;
+        var >>= 7;
+    }
+    while(var);
+    while(count--)
+        Bytes_U8(bytes, stack[count] | (count ? 0x80 : 0x00));
+}
+
+static uint32_t
+Rand_Next(uint32_t* state) // Xorshift - output depends only on the seed.
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static Bytes*
+Song_Track(Song* song)
+{
+    song->track = realloc(song->track, (song->count + 1) * sizeof(*song->track));
+    Bytes* track = &song->track[song->count++];
+    *track = (Bytes) { 0 };
+    return track;
+}
+
+static void
+Track_Message(Bytes* track, uint32_t delta, uint8_t leader, uint8_t a, uint8_t b)
+{
+    Bytes_Var(track, delta);
+    Bytes_U8(track, leader);
+    Bytes_U8(track, a);
+    Bytes_U8(track, b);
+}
+
+static void
+Track_Setup(Bytes* track, uint8_t channel, uint8_t program)
+{
+    Bytes_Var(track, 0);
+    Bytes_U8(track, 0xC0 | channel);
+    Bytes_U8(track, program);
+    Track_Message(track, 0, 0xB0 | channel, 0x07, 100);
+}
+
+static void
+Track_Tempo(Bytes* track, uint32_t delta, uint32_t tempo)
+{
+    Bytes_Var(track, delta);
+    Bytes_U8(track, 0xFF);
+    Bytes_U8(track, 0x51);
+    Bytes_U8(track, 0x03);
+    Bytes_U8(track, tempo >> 16);
+    Bytes_U8(track, tempo >> 8);
+    Bytes_U8(track, tempo >> 0);
+}
+
+static void
+Track_Text(Bytes* track, uint32_t delta, uint32_t size)
+{
+    Bytes_Var(track, delta);
+    Bytes_U8(track, 0xFF);
+    Bytes_U8(track, 0x01);
+    Bytes_Var(track, size);
+    for(uint32_t i = 0; i < size; i++)
+        Bytes_U8(track, 'a' + i % 26);
+}
+
+static void
+Track_Sysex(Bytes* track, uint32_t delta, uint32_t size)
+{
+    Bytes_Var(track, delta);
+    Bytes_U8(track, 0xF0);
+    Bytes_Var(track, size);
+    for(uint32_t i = 0; i < size - 1; i++)
+        Bytes_U8(track, i & 0x7F);
+    Bytes_U8(track, 0xF7);
+}
+
+static void
+Track_End(Bytes* track)
+{
+    Bytes_Var(track, 0);
+    Bytes_U8(track, 0xFF);
+    Bytes_U8(track, 0x2F);
+    Bytes_U8(track, 0x00);
+}
+
+static void
+Song_Conductor(Song* song)
+{
+    Bytes* track = Song_Track(song);
+    Track_Tempo(track, 0, CONST_TEMPO);
+    Track_End(track);
+}
+
+static void
+Song_Poly(Song* song) // Every channel holding sixteen note chords.
+{
+    Song_Conductor(song);
+    for(uint8_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+    {
+        Bytes* track = Song_Track(song);
+        Track_Setup(track, channel, 8 * channel);
+        for(int chord = 0; chord < 64; chord++)
+        {
+            for(int note = 0; note < 16; note++)
+                Track_Message(track, 0, 0x90 | channel, 36 + 3 * note + chord % 5, 100);
+            for(int note = 0; note < 16; note++)
+                Track_Message(track, note == 0 ? CONST_DIVISION / 2 : 0, 0x80 | channel, 36 + 3 * note + chord % 5, 0);
+        }
+        Track_End(track);
+    }
+}
+
+static void
+Song_Tracks(Song* song) // Hundreds of mostly idle tracks.
+{
+    Song_Conductor(song);
+    uint32_t seed = 0x1234567;
+    for(int number = 0; number < CONST_MANY_TRACKS; number++)
+    {
+        Bytes* track = Song_Track(song);
+        uint8_t channel = number % CONST_CHANNEL_MAX;
+        Track_Setup(track, channel, Rand_Next(&seed) % 112);
+        uint32_t delta = Rand_Next(&seed) % (2 * CONST_DIVISION);
+        for(int i = 0; i < 16; i++)
+        {
+            uint8_t note = 40 + Rand_Next(&seed) % 48;
+            Track_Message(track, delta, 0x90 | channel, note, 80);
+            Track_Message(track, CONST_DIVISION, 0x80 | channel, note, 0);
+            delta = 3 * CONST_DIVISION;
+        }
+        Track_End(track);
+    }
+}
+
+static void
+Song_Bend(Song* song) // Pitch bend on every tick of every channel.
+{
+    Song_Conductor(song);
+    for(uint8_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+    {
+        Bytes* track = Song_Track(song);
+        Track_Setup(track, channel, 8 * channel);
+        for(int bar = 0; bar < 8; bar++)
+        {
+            for(int note = 0; note < 4; note++)
+                Track_Message(track, 0, 0x90 | channel, 48 + 4 * note + channel, 100);
+            for(int tick = 0; tick < 4 * CONST_DIVISION; tick++)
+            {
+                uint16_t bend = 8192 + 4096 * ((tick % 64) - 32) / 32;
+                Track_Message(track, 1, 0xE0 | channel, bend & 0x7F, bend >> 7);
+            }
+            for(int note = 0; note < 4; note++)
+                Track_Message(track, 0, 0x80 | channel, 48 + 4 * note + channel, 0);
+        }
+        Track_End(track);
+    }
+}
+
+static void
+Song_Zero(Song* song) // Long bursts of events sharing a single tick.
+{
+    Song_Conductor(song);
+    for(uint8_t channel = 0; channel < 8; channel++)
+    {
+        Bytes* track = Song_Track(song);
+        Track_Setup(track, channel, 8 * channel);
+        for(int burst = 0; burst < 8; burst++)
+        {
+            for(int i = 0; i < CONST_ZERO_RUN; i++)
+            {
+                uint8_t note = 36 + i % 64;
+                Track_Message(track, i == 0 ? CONST_DIVISION : 0, 0xB0 | channel, 0x07, i % 128);
+                Track_Message(track, 0, 0x90 | channel, note, 90);
+                Track_Message(track, 0, 0x80 | channel, note, 0);
+            }
+            Track_Message(track, 0, 0x90 | channel, 60, 90);
+            Track_Message(track, CONST_DIVISION, 0x80 | channel, 60, 0);
+        }
+        Track_End(track);
+    }
+}
+
+static void
+Song_Sysex(Song* song) // Large SysEx dumps and text blocks between notes.
+{
+    Song_Conductor(song);
+    Bytes* dump = Song_Track(song);
+    for(int i = 0; i < 32; i++)
+    {
+        Track_Sysex(dump, CONST_DIVISION, CONST_SYSEX_SIZE);
+        Track_Text(dump, 0, CONST_TEXT_SIZE);
+    }
+    Track_End(dump);
+    Bytes* notes = Song_Track(song);
+    Track_Setup(notes, 0, 0);
+    for(int i = 0; i < 128; i++)
+    {
+        Track_Message(notes, i == 0 ? 0 : CONST_DIVISION / 4, 0x90, 48 + i % 24, 100);
+        Track_Message(notes, CONST_DIVISION / 4, 0x80, 48 + i % 24, 0);
+    }
+    Track_End(notes);
+}
+
+static void
+Song_Tones(Song* song) // Golden corpus - every bank, staggered.
+{
+    Song_Conductor(song);
+    for(uint8_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+    {
+        Bytes* track = Song_Track(song);
+        Track_Setup(track, channel, 8 * channel);
+        Track_Message(track, channel * CONST_DIVISION / 2, 0x90 | channel, 60, 100);
+        Track_Message(track, CONST_DIVISION / 2, 0xE0 | channel, 0x00, 0x50);
+        Track_Message(track, CONST_DIVISION / 2, 0x80 | channel, 60, 0);
+        Track_Message(track, 0, 0x90 | channel, 67, 70);
+        Track_Message(track, CONST_DIVISION / 2, 0x80 | channel, 67, 0);
+        Track_End(track);
+    }
+}
+
+static void
+Song_Chords(Song* song) // Golden corpus - chords under changing velocity and volume.
+{
+    Song_Conductor(song);
+    uint8_t programs[] = { 0, 32, 56, 80 };
+    for(uint8_t channel = 0; channel < 4; channel++)
+    {
+        Bytes* track = Song_Track(song);
+        Track_Setup(track, channel, programs[channel]);
+        for(int chord = 0; chord < 8; chord++)
+        {
+            Track_Message(track, 0, 0xB0 | channel, 0x07, 127 - 10 * chord);
+            for(int note = 0; note < 4; note++)
+                Track_Message(track, 0, 0x90 | channel, 48 + 12 * channel / 2 + 4 * note + chord, 40 + 10 * chord);
+            for(int note = 0; note < 4; note++)
+                Track_Message(track, note == 0 ? CONST_DIVISION / 2 : 0, 0x80 | channel, 48 + 12 * channel / 2 + 4 * note + chord, 0);
+        }
+        Track_End(track);
+    }
+}
+
+static void
+Song_Bends(Song* song) // Golden corpus - held notes under bend sweeps.
+{
+    Song_Conductor(song);
+    uint8_t programs[] = { 16, 72, 88 };
+    for(uint8_t channel = 0; channel < 3; channel++)
+    {
+        Bytes* track = Song_Track(song);
+        Track_Setup(track, channel, programs[channel]);
+        Track_Message(track, 0, 0x90 | channel, 55 + 5 * channel, 100);
+        for(int step = 0; step < 4 * CONST_DIVISION / 8; step++)
+        {
+            uint16_t bend = 8192 + 32 * step;
+            Track_Message(track, 8, 0xE0 | channel, bend & 0x7F, bend >> 7);
+        }
+        Track_Message(track, 0, 0x80 | channel, 55 + 5 * channel, 0);
+        Track_End(track);
+    }
+}
+
+static void
+Song_Dense(Song* song) // Golden corpus - chords growing until the mix runs into the limiter.
+{
+    Song_Conductor(song);
+    uint8_t programs[] = { 0, 8, 32, 40, 56, 64, 80, 104 };
+    for(uint8_t channel = 0; channel < 8; channel++)
+    {
+        Bytes* track = Song_Track(song);
+        Track_Setup(track, channel, programs[channel]);
+        for(int chord = 0; chord < 4; chord++)
+        {
+            int notes = 2 * (chord + 1);
+            for(int note = 0; note < notes; note++)
+                Track_Message(track, 0, 0x90 | channel, 40 + 3 * channel + 5 * note, 127);
+            for(int note = 0; note < notes; note++)
+                Track_Message(track, note == 0 ? CONST_DIVISION : 0, 0x80 | channel, 40 + 3 * channel + 5 * note, 0);
+        }
+        Track_End(track);
+    }
+}
+
+static void
+Song_Malformed(Song* song) // Golden corpus - a note past the seven bit key range, which must be rejected.
+{
+    Song_Conductor(song);
+    Bytes* track = Song_Track(song);
+    Track_Setup(track, 15, 0);
+    Track_Message(track, 0, 0x9F, 0xFF, 0x40);
+    Track_Message(track, CONST_DIVISION, 0x8F, 0xFF, 0x00);
+    Track_End(track);
+}
+
+static Kind KINDS[] = {
+    { "poly", Song_Poly },
+    { "tracks", Song_Tracks },
+    { "bend", Song_Bend },
+    { "zero", Song_Zero },
+    { "sysex", Song_Sysex },
+    { "tones", Song_Tones },
+    { "chords", Song_Chords },
+    { "bends", Song_Bends },
+    { "dense", Song_Dense },
+    { "malformed", Song_Malformed },
+};
+
+static void
+Song_Write(Song* song, FILE* file)
+{
+    Bytes header = { 0 };
+    Bytes_U32(&header, 0x4D546864); // MThd.
+    Bytes_U32(&header, 6);
+    Bytes_U16(&header, 1);
+    Bytes_U16(&header, song->count);
+    Bytes_U16(&header, CONST_DIVISION);
+    fwrite(header.data, 1, header.size, file);
+    for(uint16_t i = 0; i < song->count; i++)
+    {
+        Bytes chunk = { 0 };
+        Bytes_U32(&chunk, 0x4D54726B); // MTrk.
+        Bytes_U32(&chunk, song->track[i].size);
+        fwrite(chunk.data, 1, chunk.size, file);
+        fwrite(song->track[i].data, 1, song->track[i].size, file);
+        free(chunk.data);
+    }
+    free(header.data);
+}
+
+static void
+Song_Free(Song* song)
+{
+    for(uint16_t i = 0; i < song->count; i++)
+        free(song->track[i].data);
+    free(song->track);
+}
+
+int
+main(int argc, char** argv)
+{
+    uint32_t kinds = sizeof(KINDS) / sizeof(*KINDS);
+    if(argc != 3)
+    {
+        fputs("./midigen <kind> <out.mid>\nkinds:", stderr);
+        for(uint32_t i = 0; i < kinds; i++)
+            fprintf(stderr, " %s", KINDS[i].name);
+        fputs("\n", stderr);
+        exit(1);
+    }
+    for(uint32_t i = 0; i < kinds; i++)
+        if(strcmp(argv[1], KINDS[i].name) == 0)
+        {
+            FILE* file = fopen(argv[2], "wb");
+            if(file == NULL)
+                exit(2);
+            Song song = { 0 };
+            KINDS[i].make(&song);
+            Song_Write(&song, file);
+            Song_Free(&song);
+            fclose(file);
+            exit(0);
+        }
+    fprintf(stderr, "unknown kind '%s'\n", argv[1]);
+    exit(1);
+}
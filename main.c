@@ -1,110 +1,241 @@
+#define _GNU_SOURCE
+
 #include <math.h>
 #include <stdio.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <SDL2/SDL.h>
 
-#define CONST_PI (3.14159265358979323846f)
-#define CONST_NOTE_ATTACK (4)
-#define CONST_NOTE_AMPLIFICATION (15)
-#define CONST_NOTES_MAX (128)
-#define CONST_CHANNEL_MAX (16)
-#define CONST_NOTE_DECAY (512)
-#define CONST_BEND_DEFAULT (8192)
-#define CONST_SAMPLE_FREQ (44100)
+// The player is built as one translation unit with the library core, so it keeps
+// inlining across the synth and reaches internals the public API does not expose.
+#include "minimidi.c"
+
 #define CONST_XRES (1024)
 #define CONST_YRES (768)
 #define CONST_VIDEO_SAMPLES (2048)
 #define CONST_VIDEO_GRAIN (5)
 #define CONST_VIDEO_POINT_COUNT (CONST_VIDEO_SAMPLES / CONST_VIDEO_GRAIN)
-#define CONST_MODULATION_GAIN (512)
-#define CONST_BANK_WIDTH (8)
 #define CONST_FONT_H (9)
 #define CONST_FONT_W (7)
 #define CONST_FONT_M (2)
 #define CONST_FONT_RENDER_H (CONST_FONT_M * CONST_FONT_H)
 #define CONST_FONT_RENDER_W (CONST_FONT_M * CONST_FONT_W)
+#define CONST_FONT_CHARS " 0123456789:"
 #define CONST_CHANNEL_HEIGHT (CONST_YRES / CONST_CHANNEL_MAX)
-
-static bool DONE = false;
-
-enum
+#define CONST_BENCH_SECONDS (4)
+#define CONST_AUDIO_SAMPLES (1024)
+#define CONST_LIVE_SAMPLES (256)
+#define CONST_LIVE_PENDING (4096)
+#define CONST_VOLUME_DEFAULT (100)
+#define CONST_DAEMON_BACKLOG (64)
+#define CONST_DAEMON_SIZE_MAX (64 << 20)
+#define CONST_DAEMON_BUFFER (1 << 16)
+#define CONST_DAEMON_TIMEOUT (10) // Seconds a client has to send its request, and to take each write.
+#define CONST_CACHE_MEMORY (64 << 20)
+#define CONST_ANALYZE_BUCKETS (1 << 16) // Event density entries per file, widened past 18 hours.
+#define CONST_TRACE_SPANS (1 << 16)
+#define CONST_TRACE_PATH "minimidi.trace.json"
+#define CONST_RT_PRIORITY (80)
+#define CONST_RT_CPUS (64)
+#define CONST_RT_STACK (256 * 1024)
+#define CONST_GOVERNOR_HIGH (70)
+#define CONST_GOVERNOR_LOW (35)
+#define CONST_GOVERNOR_HOLD (8)
+#define CONST_GOVERNOR_CALM (128)
+#define CONST_GOVERNOR_PATIENCE (16)
+#define CONST_SINKS_MAX (4)
+#define CONST_SINK_RING (1 << 18)
+#define CONST_STEM_FRAMES (1 << 14)
+#define CONST_STEM_PATH (4096)
+#define CONST_WATCH_POLL (100)
+#define CONST_WATCH_SETTLE (50)
+#define CONST_COMPILED_MAGIC (0x4D4D4943) // MMIC.
+#define CONST_COMPILED_VERSION (3)
+#define CONST_COMPILED_PATH (4096)
+#define CONST_FNV_BASIS (0xCBF29CE484222325)
+
+typedef enum
 {
     ERROR_NONE,
     ERROR_ARGC,
     ERROR_FILE,
     ERROR_CRASH,
+    ERROR_GOLDEN,
 }
 Error;
 
+static bool DONE = false;
+
+#ifdef MINIMIDI_TRACE
+
+// Each thread owns one preallocated buffer, so recording a span never locks or allocates.
+enum
+{
+    TRACE_MIDI,
+    TRACE_AUDIO,
+    TRACE_VIDEO,
+    TRACE_THREADS,
+};
+
 typedef struct
 {
-    uint32_t tempo;
-    int instruments[CONST_CHANNEL_MAX];
-    int bend[CONST_CHANNEL_MAX];
-    float volume[CONST_CHANNEL_MAX];
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
 }
-Meta;
+Span;
 
 typedef struct
 {
-    uint8_t* data;
-    uint32_t size;
+    Span span[CONST_TRACE_SPANS];
+    uint32_t count;
+    uint32_t dropped;
 }
-Bytes;
+Trace;
 
-typedef struct
+static Trace TRACE[TRACE_THREADS];
+
+static void
+Trace_Push(int thread, const char* name, uint64_t begin)
 {
-    int gain;
-    int gain_setpoint;
-    int progress;
-    int bend_last;
-    int cycle;
-    float id;
-    bool on;
-    bool wait;
-    bool was_init;
+    Trace* trace = &TRACE[thread];
+    if(trace->count == CONST_TRACE_SPANS)
+    {
+        trace->dropped += 1;
+        return;
+    }
+    Span span = { name, begin, SDL_GetPerformanceCounter() };
+    trace->span[trace->count++] = span;
+}
+
+static void
+Trace_Dump(const char* path)
+{
+    static const char* names[] = { "midi", "audio", "video" };
+    FILE* out = fopen(path, "w");
+    if(out == NULL)
+        return;
+    double scale = 1e6 / SDL_GetPerformanceFrequency();
+    fprintf(out, "{\"traceEvents\":[\n");
+    for(int thread = 0; thread < TRACE_THREADS; thread++)
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}\n", thread ? "," : "", thread, names[thread]);
+    for(int thread = 0; thread < TRACE_THREADS; thread++)
+    {
+        Trace* trace = &TRACE[thread];
+        for(uint32_t i = 0; i < trace->count; i++)
+        {
+            Span* span = &trace->span[i];
+            fprintf(out, ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}\n",
+                span->name, thread, span->begin * scale, (span->end - span->begin) * scale);
+        }
+        if(trace->dropped > 0)
+            fprintf(stderr, "trace: %s dropped %u spans\n", names[thread], trace->dropped);
+    }
+    fprintf(out, "]}\n");
+    fclose(out);
 }
-Note;
+
+#define TRACE_BEGIN(span) uint64_t trace_##span = SDL_GetPerformanceCounter()
+#define TRACE_END(thread, span) Trace_Push(thread, #span, trace_##span)
+#define TRACE_DUMP() Trace_Dump(CONST_TRACE_PATH)
+
+#else
+
+#define TRACE_BEGIN(span)
+#define TRACE_END(thread, span)
+#define TRACE_DUMP()
+
+#endif
+
+#ifdef MINIMIDI_FIXED
+#define CONST_ENGINE_DEFAULT (ENGINE_FIXED)
+#else
+#define CONST_ENGINE_DEFAULT (ENGINE_FLOAT)
+#endif
 
 typedef struct
 {
-    Note note[CONST_CHANNEL_MAX][CONST_NOTES_MAX];
+    int fd;
+    uint8_t pending[CONST_LIVE_PENDING];
+    uint32_t pending_size;
+    uint64_t pending_since;
+    uint8_t running_status;
+    uint8_t data[2];
+    uint8_t count;
+    bool sysex;
+    uint32_t messages;
+    uint32_t blocks;
+    double latency_sum;
+    double latency_max;
+    uint64_t reported;
 }
-Notes;
+Live;
 
 typedef struct
 {
-    Note* modu;
-    Meta* meta;
-    uint8_t channel;
-    int id;
-    int bank;
+    int policy;
+    int priority;
+    int cpu;
+    int workers[CONST_RT_CPUS];
+    int worker_count;
+    bool lock;
 }
-Wave;
-
-typedef int16_t Signal(Wave*, Note*, float fm);
+Realtime;
 
 typedef struct
 {
     FILE* file;
+    char* path;
     bool loop;
+    char* render;
+    char* golden;
+    char* live;
+    char* daemon;
+    char* wav;
+    char* pipe;
+    char* stems;
+    char* compiled;
+    int workers;
+    bool stream;
+    bool watch;
+    bool analyze;
+    bool bench;
+    bool golden_update;
+    Engine engine;
+    Realtime rt;
+    int threads;
+    char** songs;
+    int song_count;
 }
 Args;
 
 typedef struct
 {
-    uint8_t* data;
-    uint32_t id;
-    uint32_t size;
-    uint32_t index;
-    uint32_t number;
-    int64_t delay;
-    uint8_t running_status;
-    bool run;
+    char* name;
+    bool stream;
+    Engine engine;
+    int threads;
+    uint32_t against; // Earlier path this render is compared with.
+    double snr_min; // Zero demands an identical render.
 }
-Track;
+Path;
 
 typedef struct
 {
@@ -123,903 +254,2613 @@ Video;
 
 typedef struct
 {
-    Audio* audio;
-    Notes* notes;
-    Notes* modus;
-    Meta* meta;
-    Video* video;
+    SDL_mutex* mutex;
+    SDL_cond* ready;
+    SDL_cond* space;
+    int client[CONST_DAEMON_BACKLOG];
+    uint32_t head;
+    uint32_t count;
+    Synth synth;
+    Realtime* rt;
 }
-Consumer;
+Daemon;
 
 typedef struct
 {
-    Track* track;
-    uint32_t id;
-    uint32_t size;
-    uint16_t format_type;
-    uint16_t track_count;
-    uint16_t time_division;
+    Daemon* daemon;
+    SDL_Thread* thread;
+    int number;
+    Notes* notes;
+    Notes* modus;
+    Midi midi;
+    Bytes request;
+    uint32_t capacity;
+    char* buffer;
+    jmp_buf crash;
 }
-Midi;
+Worker;
 
-static int
-Meta_GetBank(Meta* meta, int channel)
+typedef struct
 {
-    return meta->instruments[channel] / CONST_BANK_WIDTH;
-}
+    char* path;
+    char* compiled;
+    bool stream;
+    FILE* file;
+    Bytes bytes;
+    Midi midi;
+    void* map;
+    size_t map_size;
+    bool ok;
+    SDL_Thread* thread;
+    Realtime* rt;
+}
+Song;
+
+// The loop is rendered offline from its own parse of the song, at full quality, while the
+// first pass plays live. The audio thread alone reads the cache.
+typedef struct
+{
+    int16_t* data;
+    FILE* spill;
+    uint64_t size;
+    uint64_t cursor;
+    uint32_t channels;
+    Song song;
+    Engine engine;
+    SDL_Thread* thread;
+    SDL_atomic_t filled;
+    SDL_atomic_t played;
+    bool replaying;
+}
+Cache;
+
+// File sinks are fed through a single producer, single consumer ring: the audio
+// thread only copies and publishes head, the writer thread only drains and publishes tail.
+typedef struct
+{
+    char* path;
+    FILE* file;
+    bool wav;
+    bool failed;
+    uint16_t channels;
+    int16_t* ring;
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    SDL_atomic_t closed;
+    uint32_t dropped;
+    uint64_t written;
+    SDL_Thread* thread;
+}
+Sink;
 
-static Bytes
-Bytes_FromFile(FILE* file)
+typedef struct
 {
-    fseek(file, 0, SEEK_END);
-    uint32_t size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    Bytes bytes = { 0 };
-    bytes.size = size;
-    bytes.data = calloc(bytes.size, sizeof(*bytes.data));
-    for(uint32_t i = 0; i < bytes.size; i++)
-        bytes.data[i] = getc(file);
-    return bytes;
+    Audio* audio;
+    Sink sink[CONST_SINKS_MAX];
+    int count;
 }
+Sinks;
 
-static void
-Bytes_Free(Bytes* bytes)
+typedef struct
 {
-    free(bytes->data);
-    bytes->data = NULL;
-    bytes->size = 0;
+    Audio* audio;
+    Notes* notes;
+    Notes* modus;
+    Meta* meta;
+    Live* live;
+    Cache* cache;
+    Synth* synth;
+    Realtime* rt;
+    Sinks* sinks;
+    uint64_t boot;
 }
+Consumer;
 
-static uint8_t
-Bytes_U8(Bytes* bytes, uint32_t index)
+typedef struct
 {
-    return bytes->data[index];
+    Args* args;
+    Song* song;
+    Notes* notes;
+    Meta* meta;
+    Cache* cache;
 }
+Producer;
 
-static uint16_t
-Bytes_U16(Bytes* bytes, uint32_t index)
+typedef struct
 {
-    return Bytes_U8(bytes, index + 0) << 8
-         | Bytes_U8(bytes, index + 1);
+    double load;
+    uint32_t hold;
+    uint32_t calm;
+    uint32_t patience;
+    bool raised;
+    bool playing;
 }
+Governor;
 
-static uint32_t
-Bytes_U32(Bytes* bytes, uint32_t index)
+typedef struct
 {
-    return Bytes_U16(bytes, index + 0) << 16
-         | Bytes_U16(bytes, index + 2);
+    Render render;
+    Midi midi;
+    Notes* notes;
+    Notes* modus;
+    Meta meta;
+    uint64_t end;
+    FILE* out;
+    SDL_Thread* thread;
+    Realtime* rt;
+    int number;
 }
+Segment;
 
-static void
-Note_Clamp(Note* note)
+// One stem per MIDI channel plus the master mix, opened on their first audible block.
+typedef struct
 {
-    int min = 0;
-    int max = CONST_NOTE_ATTACK * 127;
-    if(note->gain < min) note->gain = min;
-    if(note->gain > max) note->gain = max;
+    char path[CONST_STEM_PATH];
+    FILE* file;
 }
+Stem;
 
-static void
-Note_Roll(Note* note) // Attack and Decay/Sustain.
+typedef struct
 {
-    int diff = note->gain_setpoint - note->gain;
-    if(diff == 0)
-    {
-        if(note->gain == 0)
-        {
-            note->was_init = false;
-            note->on = false;
-        }
-        // Note decays when held.
-        else
-        {
-            if(note->progress != 0)
-            {
-                bool must_decay = note->progress % CONST_NOTE_DECAY == 0;
-                if(must_decay)
-                {
-                    note->gain -= 1;
-                    note->gain_setpoint -= 1;
-                }
-            }
-        }
-    }
-    // Note delta ramp - prevents clicks and pops.
-    else
-    {
-        int step = diff / abs(diff);
-        note->gain += step;
-    }
+    Stem stem[CONST_CHANNEL_MAX + 1];
+    int32_t* parts;
+    int16_t* frames;
+    uint64_t written;
+    uint32_t fill;
+    uint32_t channels;
+    Engine engine;
 }
+Stems;
 
-static void
-Note_Process(Note* note)
+// Header of a compiled song: the tempo map follows, then the events, each as laid out in memory.
+// Files are named by the hash of the source, which is checked again along with every size and
+// a checksum of everything after the header.
+typedef struct
 {
-    Note_Roll(note);
-    Note_Clamp(note);
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint64_t checksum;
+    uint64_t source_size;
+    uint64_t ticks;
+    uint64_t scale;
+    uint32_t tempo_count;
+    uint32_t event_count;
+    uint16_t tempo_size;
+    uint16_t event_size;
+    uint16_t time_division;
+    uint16_t reserved;
 }
+Compiled;
 
-static float
-Note_Freq(Note* note)
+// Reloads of a watched file are parsed off the player thread and handed over through ready.
+typedef struct
 {
-    return 440.0f * powf(2.0f, (note->id - 69.0f) / 12.0f);
+    char* path;
+    char* dir;
+    char* name;
+    int fd;
+    Song song;
+    jmp_buf crash;
+    SDL_atomic_t ready;
+    SDL_Thread* thread;
 }
+Watch;
 
-static float
-Note_Step(Note* note, float progress)
+static Bytes
+Bytes_FromFile(FILE* file)
 {
-    float freq = Note_Freq(note);
-    return (progress * (2.0f * CONST_PI) * freq) / CONST_SAMPLE_FREQ;
+    fseek(file, 0, SEEK_END);
+    uint32_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    Bytes bytes = { 0 };
+    bytes.size = size;
+    bytes.data = calloc(bytes.size, sizeof(*bytes.data));
+    bytes.size = fread(bytes.data, sizeof(*bytes.data), bytes.size, file);
+    return bytes;
 }
 
-static float
-Note_Tick(Note* note, int bend, int id)
+static Bytes
+Bytes_FromFileAt(FILE* file, uint32_t offset, uint32_t size)
 {
-    if(!note->was_init)
-    {
-        note->was_init = true;
-        note->id = id;
-    }
-    if(bend != note->bend_last)
-    {
-        note->bend_last = bend;
-        note->wait = true;
-    }
-    float x0 = Note_Step(note, note->progress - 0.2f);
-    float x1 = Note_Step(note, note->progress + 0.0f);
-    float a = note->gain * sinf(x0);
-    float b = note->gain * sinf(x1);
-    bool crossed = a < 0.0f && b > 0.0f;
-    if(crossed)
+    Bytes bytes = { 0 };
+    bytes.data = calloc(size, sizeof(*bytes.data));
+    fseek(file, offset, SEEK_SET);
+    bytes.size = fread(bytes.data, sizeof(*bytes.data), size, file);
+    if(bytes.size != size)
     {
-        note->cycle += 1;
-        // Note frequency can only be changed at axis crossing.
-        if(note->wait)
-        {
-            float bend_semitones = 12.0f;
-            float bend_id = (bend - CONST_BEND_DEFAULT) / (CONST_BEND_DEFAULT / bend_semitones);
-            note->id = bend_id + id;
-            note->wait = false;
-            note->progress = 0;
-        }
+        fprintf(stderr, "file truncated at offset %u\n", offset);
+        exit(ERROR_FILE);
     }
-    float x = Note_Step(note, note->progress);
-    note->progress += 1;
-    return x;
+    return bytes;
 }
 
-static void
-Notes_Setup(Notes* modus)
+static uint64_t
+Hash_Fnv(uint64_t hash, const void* data, uint64_t size) // FNV-1a, continuing from hash.
 {
-    for(int i = 0; i < CONST_CHANNEL_MAX; i++)
-    for(int j = 0; j < CONST_NOTES_MAX; j++)
+    const uint8_t* bytes = data;
+    for(uint64_t i = 0; i < size; i++)
     {
-        Note* note = &modus->note[i][j];
-        note->gain = note->gain_setpoint = CONST_MODULATION_GAIN;
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
     }
+    return hash;
 }
 
-static int16_t // Sin
-Wave_SIN(Wave* wave, Note* note, float fm)
+static uint64_t
+Bytes_Hash(Bytes* bytes)
 {
-    int bend = wave->meta->bend[wave->channel];
-    float x = Note_Tick(note, bend, wave->id);
-    return note->gain * sinf(x + fm);
+    return Hash_Fnv(CONST_FNV_BASIS, bytes->data, bytes->size);
 }
 
-static int16_t // Sin Half
-Wave_SNH(Wave* wave, Note* note, float fm)
+static void
+Bytes_Free(Bytes* bytes)
 {
-    int16_t amp = Wave_SIN(wave, note, fm);
-    return amp > 0 ? (1.1f * amp) : 0;
+    free(bytes->data);
+    bytes->data = NULL;
+    bytes->size = 0;
 }
 
-static int16_t // Sin Quarter
-Wave_SNQ(Wave* wave, Note* note, float fm)
+static void
+Args_Usage(void)
 {
-    float f = Note_Step(note, note->progress);
-    int16_t x = 0.4f * Wave_SNH(wave, note, fm);
-    return cosf(f) > 0.0f ? x : 0;
+    puts("./minimidi [--stream] [--fixed | --polyblep] [--bench] [--render <out.pcm> [--threads <count>] | --stems <dir>] <file> <loop [0, 1]> [file ...]");
+    puts("./minimidi --golden <hashes> | --golden-update <hashes>");
+    puts("./minimidi --analyze <file> [file ...]");
+    puts("./minimidi --live <device or fifo>");
+    puts("./minimidi --watch <file> <loop [0, 1]>");
+    puts("sinks: [--wav <out.wav>] [--pipe <path or ->]");
+    puts("songs: [--song-cache <dir>]");
+    puts("./minimidi --daemon <socket> [--workers <count>]");
+    puts("realtime: [--rt <fifo, rr>] [--rt-priority <1-99>] [--cpu <audio cpu>] [--worker-cpus <cpu,cpu,...>] [--mlock]");
+    exit(ERROR_ARGC);
 }
 
-static int16_t // Square
-Wave_SQR(Wave* wave, Note* note, float fm)
+static char*
+Args_Value(int argc, char** argv, int* i)
 {
-    int16_t amp = Wave_SIN(wave, note, fm);
-    return (amp >= 0 ? note->gain : -note->gain) / 8.0f;
+    if(*i + 1 >= argc)
+        Args_Usage();
+    *i += 1;
+    return argv[*i];
 }
 
-static int16_t // Triangle
-Wave_TRI(Wave* wave, Note* note, float fm)
+static int
+Args_Policy(char* value)
 {
-    int bend = wave->meta->bend[wave->channel];
-    float x = Note_Tick(note, bend, wave->id);
-    return note->gain * asinf(sinf(x + fm)) / 1.5708f / 3.0f;
+    if(strcmp(value, "fifo") == 0)
+        return SCHED_FIFO;
+    if(strcmp(value, "rr") == 0)
+        return SCHED_RR;
+    Args_Usage();
+    return SCHED_OTHER;
 }
 
-static int16_t // Triangle Half
-Wave_TRH(Wave* wave, Note* note, float fm)
+static int
+Args_Cpus(char* value, int* cpus)
 {
-    int16_t amp = Wave_TRI(wave, note, fm);
-    return amp > 0 ? (1.6f * amp) : 0;
+    int count = 0;
+    for(char* cpu = strtok(value, ","); cpu && count < CONST_RT_CPUS; cpu = strtok(NULL, ","))
+        cpus[count++] = atoi(cpu);
+    return count;
 }
 
-static float
-Flatten(int16_t gain)
+static Args
+Args_Init(int argc, char** argv)
 {
-    return gain / (1.0f * CONST_MODULATION_GAIN);
+    Args args = { 0 };
+    args.loop = false;
+    args.stream = false;
+    args.watch = false;
+    args.analyze = false;
+    args.bench = false;
+    args.golden_update = false;
+    args.render = NULL;
+    args.golden = NULL;
+    args.live = NULL;
+    args.daemon = NULL;
+    args.wav = NULL;
+    args.pipe = NULL;
+    args.stems = NULL;
+    args.compiled = NULL;
+    args.workers = 0;
+    args.engine = CONST_ENGINE_DEFAULT;
+    args.threads = 1;
+    args.rt.policy = SCHED_OTHER;
+    args.rt.priority = CONST_RT_PRIORITY;
+    args.rt.cpu = -1;
+    args.rt.worker_count = 0;
+    args.rt.lock = false;
+    args.file = NULL;
+    args.songs = calloc(argc, sizeof(*args.songs));
+    args.song_count = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--stream") == 0)
+            args.stream = true;
+        else if(strcmp(argv[i], "--watch") == 0)
+            args.watch = true;
+        else if(strcmp(argv[i], "--bench") == 0)
+            args.bench = true;
+        else if(strcmp(argv[i], "--analyze") == 0)
+            args.analyze = true;
+        else if(strcmp(argv[i], "--fixed") == 0)
+            args.engine = ENGINE_FIXED;
+        else if(strcmp(argv[i], "--polyblep") == 0)
+            args.engine = ENGINE_POLYBLEP;
+        else if(strcmp(argv[i], "--rt") == 0)
+            args.rt.policy = Args_Policy(Args_Value(argc, argv, &i));
+        else if(strcmp(argv[i], "--rt-priority") == 0)
+            args.rt.priority = atoi(Args_Value(argc, argv, &i));
+        else if(strcmp(argv[i], "--cpu") == 0)
+            args.rt.cpu = atoi(Args_Value(argc, argv, &i));
+        else if(strcmp(argv[i], "--worker-cpus") == 0)
+            args.rt.worker_count = Args_Cpus(Args_Value(argc, argv, &i), args.rt.workers);
+        else if(strcmp(argv[i], "--mlock") == 0)
+            args.rt.lock = true;
+        else if(strcmp(argv[i], "--render") == 0)
+            args.render = Args_Value(argc, argv, &i);
+        else if(strcmp(argv[i], "--threads") == 0)
+            args.threads = atoi(Args_Value(argc, argv, &i));
+        else if(strcmp(argv[i], "--golden") == 0)
+            args.golden = Args_Value(argc, argv, &i);
+        else if(strcmp(argv[i], "--live") == 0)
+            args.live = Args_Value(argc, argv, &i);
+        else if(strcmp(argv[i], "--wav") == 0)
+            args.wav = Args_Value(argc, argv, &i);
+        else if(strcmp(argv[i], "--pipe") == 0)
+            args.pipe = Args_Value(argc, argv, &i);
+        else if(strcmp(argv[i], "--stems") == 0)
+            args.stems = Args_Value(argc, argv, &i);
+        else if(strcmp(argv[i], "--song-cache") == 0)
+            args.compiled = Args_Value(argc, argv, &i);
+        else if(strcmp(argv[i], "--daemon") == 0)
+            args.daemon = Args_Value(argc, argv, &i);
+        else if(strcmp(argv[i], "--workers") == 0)
+            args.workers = atoi(Args_Value(argc, argv, &i));
+        else if(strcmp(argv[i], "--golden-update") == 0)
+        {
+            args.golden = Args_Value(argc, argv, &i);
+            args.golden_update = true;
+        }
+        else if(argv[i][0] != '-')
+            args.songs[args.song_count++] = argv[i];
+        else
+            Args_Usage();
+    }
+    if(args.workers < 1)
+        args.workers = SDL_GetCPUCount();
+    if(args.golden || args.live || args.daemon)
+        return args;
+    if(args.song_count < 1)
+        Args_Usage();
+    // Every positional is a file to analyze, opened one at a time.
+    if(args.analyze)
+        return args;
+    args.path = args.songs[0];
+    args.file = fopen(args.path, "rb");
+    if(args.file == NULL)
+        exit(ERROR_FILE);
+    // The loop flag follows the first file, and any further files make a playlist.
+    if(args.song_count >= 2 && (strcmp(args.songs[1], "0") == 0 || strcmp(args.songs[1], "1") == 0))
+    {
+        args.loop = atoi(args.songs[1]) == 1;
+        memmove(&args.songs[1], &args.songs[2], (args.song_count - 2) * sizeof(*args.songs));
+        args.song_count -= 1;
+    }
+    if(args.watch && args.song_count > 1)
+        Args_Usage();
+    // Exporters rewrite the watched file in place, so it is always read whole.
+    if(args.watch)
+        args.stream = false;
+    return args;
 }
 
-static float
-Wave_GetFMMultiplier(Wave* wave)
+static void
+Args_Free(Args* args)
 {
-    return (CONST_PI / 8.0f) + (CONST_PI / 4.0f) * wave->bank / (float) CONST_BANK_WIDTH;
+    if(args->file)
+        fclose(args->file);
+    free(args->songs);
 }
 
-static int16_t
-Wave_FM(Wave* wave, Note* note, Signal a, Signal b, float volume)
+static void
+Track_Drain(Track* track, Notes* notes, Meta* meta) // Expects the first delay already read.
 {
-    float multiplier = Wave_GetFMMultiplier(wave);
-    return volume * a(wave, note, multiplier * Flatten(b(wave, wave->modu, 0.0f)));
+    while(track->run)
+    {
+        Track_Event(track, notes, meta);
+        if(track->run)
+            Track_Var(track);
+    }
 }
 
-static int16_t
-(Wave_Piano)
-(Wave* wave, Note* note, float fm)
+static Track
+Track_Stream(FILE* file, uint32_t offset, uint32_t number)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_SIN, Wave_SIN, 0.7f);
+    Bytes header = Bytes_FromFileAt(file, offset, 8);
+    Track track = { 0 };
+    track.id = Bytes_U32(&header, 0);
+    track.size = Bytes_U32(&header, 4);
+    track.data = calloc(CONST_TRACK_WINDOW, sizeof(*track.data));
+    track.file = file;
+    track.offset = offset + 8;
+    track.run = true;
+    track.number = number;
+    Bytes_Free(&header);
+    return track;
 }
 
-static int16_t
-(Wave_ChromaticPercussion)
-(Wave* wave, Note* note, float fm)
+static Audio
+Audio_Init(uint16_t samples)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.6f);
+    Audio audio = { 0 };
+    audio.spec.freq = CONST_SAMPLE_FREQ;
+    audio.spec.format = AUDIO_S16SYS;
+    audio.spec.channels = 2;
+    audio.spec.samples = samples;
+    audio.spec.callback = NULL;
+    audio.dev = SDL_OpenAudioDevice(NULL, 0, &audio.spec, NULL, 0);
+    return audio;
 }
 
-static int16_t
-(Wave_Organ)
-(Wave* wave, Note* note, float fm)
+static void
+Audio_Free(Audio* audio)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_TRH, Wave_SIN, 0.8f);
+    SDL_CloseAudioDevice(audio->dev);
 }
 
-static int16_t
-(Wave_SynthLead)
-(Wave* wave, Note* note, float fm)
+static void
+Realtime_Report(char* what, int error)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.8f);
+    fprintf(stderr, "rt: %s: %s\n", what, error ? strerror(error) : "ok");
 }
 
-static int16_t
-(Wave_SynthPad)
-(Wave* wave, Note* note, float fm)
+static void
+Realtime_Pin(int cpu, char* who)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.8f);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    char what[64];
+    snprintf(what, sizeof(what), "%s pinned to cpu %d", who, cpu);
+    Realtime_Report(what, sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : errno);
 }
 
-static int16_t
-(Wave_SynthEffects)
-(Wave* wave, Note* note, float fm)
+static void
+Realtime_Policy(Realtime* rt, int priority, char* who)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.8f);
+    if(rt->policy != SCHED_OTHER)
+    {
+        struct sched_param param = { 0 };
+        param.sched_priority = priority;
+        char what[64];
+        snprintf(what, sizeof(what), "%s %s priority %d", who, rt->policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR", priority);
+        Realtime_Report(what, pthread_setschedparam(pthread_self(), rt->policy, &param));
+    }
 }
 
-static int16_t
-(Wave_Guitar)
-(Wave* wave, Note* note, float fm)
+static void
+Realtime_Worker(Realtime* rt, int number, char* who) // Called from the worker thread being placed.
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_SNQ, Wave_SIN, 0.6f);
+    // Workers take the --worker-cpus cores round robin, and run one priority below the audio thread
+    // so a render never preempts playback.
+    if(rt == NULL)
+        return;
+    if(rt->worker_count > 0)
+        Realtime_Pin(rt->workers[number % rt->worker_count], who);
+    Realtime_Policy(rt, rt->priority > 1 ? rt->priority - 1 : 1, who);
 }
 
-static int16_t
-(Wave_Bass)
-(Wave* wave, Note* note, float fm)
+static void
+Realtime_Thread(Realtime* rt, char* who) // Called from the thread being promoted.
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_SNH, Wave_SIN, 1.0f);
+    if(rt->cpu >= 0)
+        Realtime_Pin(rt->cpu, who);
+    Realtime_Policy(rt, rt->priority, who);
+    if(rt->lock)
+    {
+        // Faults in the stack the thread will grow into now, not mid block.
+        volatile uint8_t stack[CONST_RT_STACK];
+        for(uint32_t i = 0; i < sizeof(stack); i += 4096)
+            stack[i] = 0;
+    }
 }
 
-static int16_t
-(Wave_Pipe)
-(Wave* wave, Note* note, float fm)
+static void
+Realtime_Lock(Realtime* rt) // Call once the working set is allocated and touched.
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_SQR, Wave_TRH, 0.7f);
+    if(rt->lock)
+        Realtime_Report("mlockall", mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? 0 : errno);
 }
 
-static int16_t
-(Wave_Strings1)
-(Wave* wave, Note* note, float fm)
+static Cache
+Cache_Init(uint64_t frames, uint32_t channels)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_TRH, Wave_SIN, 0.6f);
+    // Songs that do not fit in memory spill to a temporary file.
+    Cache cache = { 0 };
+    cache.size = frames * channels;
+    cache.channels = channels;
+    if(sizeof(*cache.data) * cache.size <= CONST_CACHE_MEMORY)
+        cache.data = calloc(cache.size, sizeof(*cache.data));
+    else
+        cache.spill = tmpfile();
+    if(cache.data == NULL && cache.spill == NULL)
+        cache.size = 0;
+    return cache;
 }
 
-static int16_t
-(Wave_Strings2)
-(Wave* wave, Note* note, float fm)
+static void
+Cache_Free(Cache* cache)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_SNH, Wave_TRI, 0.5f);
+    SDL_WaitThread(cache->thread, NULL);
+    free(cache->data);
+    if(cache->spill)
+        fclose(cache->spill);
 }
 
-static int16_t
-(Wave_Brass)
-(Wave* wave, Note* note, float fm)
+static bool
+Cache_Handoff(Cache* cache, Notes* notes) // True from the first block the render replays.
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_SQR, Wave_SIN, 0.8f);
+    // The producer marks the first pass played only after its last event, so the events inside the
+    // queue lead are still mixed live. Its voices then stop for good, leaving nothing to synthesize.
+    if(cache->replaying || !SDL_AtomicGet(&cache->played))
+        return cache->replaying;
+    memset(notes, 0, sizeof(*notes));
+    cache->replaying = true;
+    return true;
 }
 
-static int16_t
-(Wave_Reed)
-(Wave* wave, Note* note, float fm)
+static void
+Cache_Read(Cache* cache, int16_t* mixes, uint32_t samples)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_SNQ, Wave_SIN, 0.8f);
+    // Wraps around mid block so the loop point is gapless.
+    if(cache->size == 0)
+    {
+        memset(mixes, 0, sizeof(*mixes) * samples);
+        return;
+    }
+    uint32_t done = 0;
+    while(done < samples)
+    {
+        uint64_t left = cache->size - cache->cursor;
+        uint32_t count = samples - done < left ? samples - done : left;
+        if(cache->data)
+            memcpy(&mixes[done], &cache->data[cache->cursor], sizeof(*mixes) * count);
+        else if(fread(&mixes[done], sizeof(*mixes), count, cache->spill) != count)
+            memset(&mixes[done], 0, sizeof(*mixes) * count);
+        done += count;
+        cache->cursor += count;
+        if(cache->cursor == cache->size)
+        {
+            cache->cursor = 0;
+            if(cache->spill)
+                rewind(cache->spill);
+        }
+    }
 }
 
-static int16_t
-(Wave_Ethnic)
-(Wave* wave, Note* note, float fm)
+static void
+Wav_U16(FILE* file, uint16_t value)
 {
-    (void) fm;
-    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.8f);
+    fputc(value & 0xFF, file);
+    fputc(value >> 8, file);
 }
 
-static int16_t
-(Wave_Percussive)
-(Wave* wave, Note* note, float fm)
+static void
+Wav_U32(FILE* file, uint32_t value)
 {
-    (void) wave;
-    (void) note;
-    (void) fm;
-    return 0.0f;
+    Wav_U16(file, value & 0xFFFF);
+    Wav_U16(file, value >> 16);
 }
 
-static int16_t
-(Wave_SoundEffects)
-(Wave* wave, Note* note, float fm)
-{
-    (void) wave;
-    (void) note;
-    (void) fm;
-    return 0.0f;
+static void
+Wav_Header(FILE* file, uint16_t channels, uint64_t bytes)
+{
+    // Sizes past the 32-bit RIFF limit are clamped; players read the data to the end.
+    uint32_t size = bytes > UINT32_MAX - 36 ? UINT32_MAX - 36 : bytes;
+    uint16_t align = channels * sizeof(int16_t);
+    fputs("RIFF", file);
+    Wav_U32(file, 36 + size);
+    fputs("WAVEfmt ", file);
+    Wav_U32(file, 16);
+    Wav_U16(file, 1);
+    Wav_U16(file, channels);
+    Wav_U32(file, CONST_SAMPLE_FREQ);
+    Wav_U32(file, CONST_SAMPLE_FREQ * align);
+    Wav_U16(file, align);
+    Wav_U16(file, 16);
+    fputs("data", file);
+    Wav_U32(file, size);
 }
 
-static int16_t
-(*WAVE_WAVEFORMS[])(Wave* wave, Note* note, float fm) = {
-    [  0 ] = Wave_Piano,
-    [  1 ] = Wave_ChromaticPercussion,
-    [  2 ] = Wave_Organ,
-    [  3 ] = Wave_Guitar,
-    [  4 ] = Wave_Bass,
-    [  5 ] = Wave_Strings1,
-    [  6 ] = Wave_Strings2,
-    [  7 ] = Wave_Brass,
-    [  8 ] = Wave_Reed,
-    [  9 ] = Wave_Pipe,
-    [ 10 ] = Wave_SynthLead,
-    [ 11 ] = Wave_SynthPad,
-    [ 12 ] = Wave_SynthEffects,
-    [ 13 ] = Wave_Ethnic,
-    [ 14 ] = Wave_Percussive,
-    [ 15 ] = Wave_SoundEffects,
-};
+static void
+Sink_Push(Sink* sink, int16_t* mixes, uint32_t samples)
+{
+    // Never waits on the writer. A block that does not fit is dropped whole, keeping frames aligned.
+    uint32_t head = SDL_AtomicGet(&sink->head);
+    uint32_t tail = SDL_AtomicGet(&sink->tail);
+    if(CONST_SINK_RING - (head - tail) < samples)
+    {
+        sink->dropped += samples;
+        return;
+    }
+    uint32_t index = head % CONST_SINK_RING;
+    uint32_t first = samples < CONST_SINK_RING - index ? samples : CONST_SINK_RING - index;
+    memcpy(&sink->ring[index], mixes, first * sizeof(*mixes));
+    memcpy(sink->ring, &mixes[first], (samples - first) * sizeof(*mixes));
+    SDL_AtomicSet(&sink->head, head + samples);
+}
 
-static Args
-Args_Init(int argc, char** argv)
+static int
+Sink_Run(void* data)
 {
-    Args args = { 0 };
-    args.loop = false;
-    args.file = NULL;
-    if(argc < 2 || argc > 3)
+    Sink* sink = data;
+    while(true)
     {
-        puts("./minimidi <file> <loop [0, 1]>");
-        exit(ERROR_ARGC);
+        // Closed is read before head, so everything pushed before closing still drains.
+        bool closed = SDL_AtomicGet(&sink->closed);
+        uint32_t head = SDL_AtomicGet(&sink->head);
+        uint32_t tail = SDL_AtomicGet(&sink->tail);
+        if(head == tail)
+        {
+            if(closed)
+                break;
+            SDL_Delay(5);
+            continue;
+        }
+        uint32_t index = tail % CONST_SINK_RING;
+        uint32_t count = head - tail < CONST_SINK_RING - index ? head - tail : CONST_SINK_RING - index;
+        // A failed writer keeps draining, so the audio thread never sees a full ring.
+        if(!sink->failed && fwrite(&sink->ring[index], sizeof(*sink->ring), count, sink->file) != count)
+        {
+            fprintf(stderr, "sink: %s: write failed\n", sink->path);
+            sink->failed = true;
+        }
+        sink->written += count;
+        SDL_AtomicSet(&sink->tail, tail + count);
     }
-    if(argc >= 2)
-        args.file = fopen(argv[1], "rb");
-    if(args.file == NULL)
-        exit(ERROR_FILE);
-    if(argc == 3)
-        args.loop = atoi(argv[2]) == 1;
-    return args;
+    fflush(sink->file);
+    return 0;
 }
 
 static void
-Args_Free(Args* args)
+Sink_Open(Sink* sink, char* path, bool wav, uint16_t channels)
 {
-    fclose(args->file);
+    sink->path = path;
+    sink->wav = wav;
+    sink->channels = channels;
+    sink->file = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if(sink->file == NULL)
+    {
+        fprintf(stderr, "sink: cannot open %s\n", path);
+        exit(ERROR_FILE);
+    }
+    // A pipe whose reader went away fails its writes instead of killing the player.
+    signal(SIGPIPE, SIG_IGN);
+    if(wav)
+        Wav_Header(sink->file, sink->channels, 0);
+    sink->ring = calloc(CONST_SINK_RING, sizeof(*sink->ring));
+    sink->thread = SDL_CreateThread(Sink_Run, "MIDI-SINK-WRITER", sink);
 }
 
 static void
-Track_Free(Track* track)
+Sink_Close(Sink* sink)
 {
-    free(track->data);
-    track->data = NULL;
+    SDL_AtomicSet(&sink->closed, true);
+    SDL_WaitThread(sink->thread, NULL);
+    // Sizes are patched in once known; a WAV written to a pipe keeps its streaming header.
+    if(sink->wav && fseek(sink->file, 0, SEEK_SET) == 0)
+        Wav_Header(sink->file, sink->channels, sink->written * sizeof(*sink->ring));
+    if(sink->dropped > 0)
+        fprintf(stderr, "sink: %s dropped %u samples\n", sink->path, sink->dropped);
+    if(sink->file != stdout)
+        fclose(sink->file);
+    free(sink->ring);
 }
 
-static void
-Track_Back(Track* track)
+static Sinks
+Sinks_Init(Audio* audio)
 {
-    track->index -= 1;
+    Sinks sinks = { 0 };
+    sinks.audio = audio;
+    return sinks;
 }
 
 static void
-Track_Next(Track* track)
+Sinks_Add(Sinks* sinks, char* path, bool wav)
 {
-    track->index += 1;
+    Sink_Open(&sinks->sink[sinks->count++], path, wav, sinks->audio->spec.channels);
 }
 
-static uint8_t
-Track_U8(Track* track)
+static void
+Sinks_Push(Sinks* sinks, int16_t* mixes, uint32_t samples)
 {
-    uint8_t byte = track->data[track->index];
-    Track_Next(track);
-    return byte;
+    // One mixed block goes to the device and every file sink, so nothing is synthesized twice.
+    SDL_LockAudioDevice(sinks->audio->dev);
+    SDL_QueueAudio(sinks->audio->dev, mixes, samples * sizeof(*mixes));
+    SDL_UnlockAudioDevice(sinks->audio->dev);
+    for(int i = 0; i < sinks->count; i++)
+        Sink_Push(&sinks->sink[i], mixes, samples);
 }
 
 static void
-Track_Spin(Track* track, int size)
+Sinks_Free(Sinks* sinks)
 {
-    while(size--)
-        Track_U8(track);
+    for(int i = 0; i < sinks->count; i++)
+        Sink_Close(&sinks->sink[i]);
 }
 
-static uint32_t
-Track_Var(Track* track)
+static Live
+Live_Init(char* path)
 {
-    uint32_t var = 0x0;
-    bool run = true;
-    while(run)
+    Live live = { 0 };
+    live.fd = open(path, O_RDONLY | O_NONBLOCK);
+    if(live.fd == -1)
     {
-        uint8_t byte = Track_U8(track);
-        var = (var << 7) | (byte & 0x7F);
-        run = byte >> 7;
+        fprintf(stderr, "live: cannot open %s\n", path);
+        exit(ERROR_FILE);
     }
-    return var;
+    return live;
 }
 
-static char*
-Track_Str(Track* track)
+static void
+Live_Free(Live* live)
 {
-    uint32_t len = Track_U8(track);
-    char* str = calloc(len + 1, sizeof(*str));
-    for(uint32_t i = 0; i < len; i++)
-        str[i] = Track_U8(track);
-    return str;
+    close(live->fd);
 }
 
-static Bytes
-Track_Bytes(Track* track)
+static void
+Live_Read(Live* live)
 {
-    Bytes bytes = { 0 };
-    bytes.size = Track_Var(track);
-    bytes.data = calloc(bytes.size, sizeof(*bytes.data));
-    for(uint32_t i = 0; i < bytes.size; i++)
-        bytes.data[i] = Track_U8(track);
-    return bytes;
+    uint32_t space = CONST_LIVE_PENDING - live->pending_size;
+    ssize_t size = read(live->fd, &live->pending[live->pending_size], space);
+    if(size > 0)
+    {
+        if(live->pending_size == 0)
+            live->pending_since = SDL_GetPerformanceCounter();
+        live->pending_size += size;
+    }
 }
 
-static void
-Track_Crash(Track* track)
+static bool
+Live_Feed(Live* live, uint8_t byte, Message* message)
 {
-    int window = 30;
-    for(int32_t i = -window; i < window; i++)
+    // System real time bytes may interleave anything and change nothing.
+    if(byte >= 0xF8)
+        return false;
+    if(byte >= 0xF0)
     {
-        uint32_t j = track->index + i;
-        if(j < track->size)
-        {
-            char* star = (j == track->index) ? "*" : "";
-            fprintf(stderr, "index %d : 0x%02X%s\n", j, track->data[j], star);
-        }
+        live->sysex = byte == 0xF0;
+        live->running_status = 0;
+        return false;
     }
-    exit(ERROR_CRASH);
+    if(byte >= 0x80)
+    {
+        live->sysex = false;
+        live->running_status = byte;
+        live->count = 0;
+        return false;
+    }
+    if(live->sysex || live->running_status == 0)
+        return false;
+    live->data[live->count++] = byte;
+    if(live->count < Message_Size(live->running_status))
+        return false;
+    live->count = 0;
+    *message = (Message) { live->running_status, live->data[0], live->data[1] };
+    return true;
 }
 
-static uint8_t
-Track_Status(Track* track, uint8_t status)
+static uint32_t
+Live_Apply(Live* live, Meta* meta, Notes* notes)
 {
-    if(status >> 3)
+    uint32_t messages = 0;
+    for(uint32_t i = 0; i < live->pending_size; i++)
     {
-        track->running_status = status;
-        return status;
+        Message message;
+        if(Live_Feed(live, live->pending[i], &message))
+        {
+            Message_Apply(&message, meta, notes);
+            messages += 1;
+        }
     }
-    else
+    live->pending_size = 0;
+    return messages;
+}
+
+static void
+Live_Report(Live* live, double latency)
+{
+    live->blocks += 1;
+    live->latency_sum += latency;
+    if(latency > live->latency_max)
+        live->latency_max = latency;
+    uint64_t now = SDL_GetPerformanceCounter();
+    if(now - live->reported > SDL_GetPerformanceFrequency())
     {
-        Track_Back(track);
-        return track->running_status;
+        fprintf(stderr, "live: %u messages, input to output latency avg %.2f ms max %.2f ms\n",
+            live->messages, 1000.0 * live->latency_sum / live->blocks, 1000.0 * live->latency_max);
+        live->reported = now;
+        live->messages = 0;
+        live->blocks = 0;
+        live->latency_sum = 0.0;
+        live->latency_max = 0.0;
     }
 }
 
-static bool
-IsPercussive(uint8_t channel)
+static Governor
+Governor_Init(void)
 {
-    return channel == 9;
+    Governor governor = { 0 };
+    governor.patience = CONST_GOVERNOR_CALM;
+    return governor;
 }
 
 static void
-Track_RealEvent(Track* track, Meta* meta, Notes* notes, uint8_t leader)
+Governor_Report(Governor* governor, Synth* synth)
 {
-    uint8_t channel = leader & 0xF;
-    uint8_t status = leader >> 4;
-    switch(Track_Status(track, status))
+    static const char* names[] = { "full", "no fm", "cheap", "capped" };
+    fprintf(stderr, "quality: %s, load %.0f%%\n", names[synth->quality], 100.0 * governor->load);
+}
+
+static void
+Governor_Update(Governor* governor, Synth* synth, uint64_t start, uint32_t frames, bool starved)
+{
+    // Load is mix time over the block's real-time budget, smoothed over about eight blocks.
+    double seconds = (SDL_GetPerformanceCounter() - start) / (double) SDL_GetPerformanceFrequency();
+    double load = seconds * CONST_SAMPLE_FREQ / frames;
+    governor->load += (load - governor->load) / 8.0;
+    // A change settles for a few blocks before the next, letting the load follow it.
+    if(governor->hold > 0)
+    {
+        governor->hold -= 1;
+        return;
+    }
+    // A dry queue only counts when mixing takes real time; otherwise the scheduler, not the synth, is late.
+    bool pressure = 100.0 * governor->load > CONST_GOVERNOR_HIGH || (starved && 100.0 * governor->load > CONST_GOVERNOR_LOW);
+    if(pressure)
     {
-        default:
+        governor->calm = 0;
+        if(synth->quality + 1 < QUALITY_STAGES)
         {
-            Track_Crash(track);
-            break;
+            // Falling back right after a step up doubles the calm needed for the next one,
+            // so a load near a stage boundary settles instead of flapping.
+            if(governor->raised && governor->patience < CONST_GOVERNOR_PATIENCE * CONST_GOVERNOR_CALM)
+                governor->patience *= 2;
+            synth->quality += 1;
+            governor->hold = CONST_GOVERNOR_HOLD;
+            governor->raised = false;
+            Governor_Report(governor, synth);
         }
-        // Note Off.
-        case 0x8:
+    }
+    else if(100.0 * governor->load < CONST_GOVERNOR_LOW)
+    {
+        governor->calm += 1;
+        if(governor->calm < governor->patience)
+            return;
+        governor->calm = 0;
+        if(synth->quality > QUALITY_FULL)
         {
-            uint8_t note_index = Track_U8(track);
-            Track_U8(track);
-            if(!IsPercussive(channel))
-            {
-                Note* note = &notes->note[channel][note_index];
-                note->gain_setpoint = 0;
-                meta->bend[channel] = CONST_BEND_DEFAULT;
-            }
-            break;
+            synth->quality -= 1;
+            governor->hold = CONST_GOVERNOR_HOLD;
+            governor->raised = true;
+            Governor_Report(governor, synth);
         }
-        // Note On.
-        case 0x9:
+        else
+        {
+            governor->patience = CONST_GOVERNOR_CALM;
+            governor->raised = false;
+        }
+    }
+    else
+        governor->calm = 0;
+}
+
+static void
+Startup_Report(char* what, uint64_t boot)
+{
+    double ms = 1000.0 * (SDL_GetPerformanceCounter() - boot) / SDL_GetPerformanceFrequency();
+    fprintf(stderr, "startup: %s after %.1f ms\n", what, ms);
+}
+
+static int
+Audio_Play(void* data)
+{
+    Consumer* consumer = data;
+    Live* live = consumer->live;
+    Realtime_Thread(consumer->rt, "audio");
+    uint32_t mixes_size = sizeof(int16_t) * consumer->audio->spec.samples;
+    int16_t* mixes = calloc(1, mixes_size);
+    Governor governor = Governor_Init();
+    bool heard = false;
+    for(int32_t cycles = 0; !DONE; cycles++)
+    {
+        if(live)
+            Live_Read(live);
+        uint32_t queue_size = SDL_GetQueuedAudioSize(consumer->audio->dev);
+        uint32_t samples = consumer->audio->spec.samples;
+        uint32_t thresh_min = 3 * consumer->audio->spec.samples;
+        uint32_t thresh_max = 5 * consumer->audio->spec.samples;
+        // The queue running dry after playback started means the mixer fell behind.
+        bool paused = queue_size < thresh_min;
+        bool starved = paused && governor.playing;
+        governor.playing = !paused;
+        SDL_PauseAudioDevice(consumer->audio->dev, paused);
+        if(queue_size < thresh_max)
         {
-            uint8_t note_index = Track_U8(track);
-            uint8_t note_velocity = Track_U8(track);
-            if(!IsPercussive(channel))
+            // Live input lands on the block boundary.
+            uint32_t messages = 0;
+            uint64_t since = live ? live->pending_since : 0;
+            if(live)
+                messages = Live_Apply(live, consumer->meta, consumer->notes);
+            TRACE_BEGIN(mix);
+            Cache* cache = consumer->cache;
+            uint64_t voices = 0;
+            if(cache && Cache_Handoff(cache, consumer->notes))
+                Cache_Read(cache, mixes, samples);
+            else
             {
-                Note* note = &notes->note[channel][note_index];
-                note->gain_setpoint = CONST_NOTE_ATTACK * note_velocity * meta->volume[channel];
-                note->on = true;
-                meta->bend[channel] = CONST_BEND_DEFAULT;
+                uint64_t start = SDL_GetPerformanceCounter();
+                voices = Audio_Mix(consumer->notes, consumer->modus, consumer->meta, mixes, samples, consumer->audio->spec.channels, consumer->synth);
+                Governor_Update(&governor, consumer->synth, start, samples / consumer->audio->spec.channels, starved);
+            }
+            TRACE_END(TRACE_AUDIO, mix);
+            TRACE_BEGIN(queue);
+            Sinks_Push(consumer->sinks, mixes, samples);
+            TRACE_END(TRACE_AUDIO, queue);
+            // Live input starts whenever the player does, so only songs report it.
+            if(voices > 0 && !heard && !live)
+            {
+                Startup_Report("first sample queued", consumer->boot);
+                heard = true;
+            }
+            if(messages > 0)
+            {
+                // Time waiting for the block, plus the audio queued ahead of it and the device buffer.
+                double bytes_per_second = sizeof(int16_t) * consumer->audio->spec.channels * CONST_SAMPLE_FREQ;
+                double waited = (SDL_GetPerformanceCounter() - since) / (double) SDL_GetPerformanceFrequency();
+                double queued = queue_size / bytes_per_second;
+                double device = consumer->audio->spec.samples / (double) CONST_SAMPLE_FREQ;
+                live->messages += messages;
+                Live_Report(live, waited + queued + device);
             }
-            break;
         }
-        // Note Aftertouch.
-        case 0xA:
+        SDL_Delay(1);
+    }
+    free(mixes);
+    return 0;
+}
+
+static void
+Track_Dump(Track* track)
+{
+    int window = 30;
+    for(int32_t i = -window; i < window; i++)
+    {
+        uint32_t j = track->index + i;
+        if(j - track->start < track->count)
         {
-            Track_Spin(track, 2);
-            break;
+            char* star = (j == track->index) ? "*" : "";
+            fprintf(stderr, "index %d : 0x%02X%s\n", j, track->data[j - track->start], star);
         }
-        // Controller.
-        case 0xB:
+    }
+}
+
+static void
+Midi_Target(Midi* midi, jmp_buf* crash) // Null clears the target once every event is checked.
+{
+    for(uint32_t number = 0; number < midi->track_count; number++)
+        midi->track[number].crash = crash;
+}
+
+static bool
+Midi_Parse(Midi* midi, Bytes* bytes) // Copies tracks from bytes, else maps the already streaming tracks.
+{
+    // A malformed event dumps the bytes around it and fails the parse, leaving the midi for Midi_Free.
+    Notes* notes = calloc(1, sizeof(*notes));
+    jmp_buf crash;
+    if(setjmp(crash))
+    {
+        for(uint32_t number = 0; number < midi->track_count; number++)
+            if(midi->track[number].crashed)
+                Track_Dump(&midi->track[number]);
+        free(notes);
+        return false;
+    }
+    if(bytes)
+        Midi_Load(midi, bytes, notes, &crash);
+    else
+    {
+        Midi_Target(midi, &crash);
+        Midi_Schedule(midi);
+        Midi_Map(midi, notes);
+    }
+    // Every event has now been read once, so playback from memory never needs the crash target.
+    // Streamed playback installs its own, as the file is read again.
+    Midi_Target(midi, NULL);
+    free(notes);
+    return true;
+}
+
+static Error
+Midi_Read(Midi* midi, Bytes* bytes) // Reports a malformed file and returns why, leaving nothing to free.
+{
+    if(!Midi_Check(bytes))
+    {
+        fprintf(stderr, "invalid midi file\n");
+        return ERROR_FILE;
+    }
+    *midi = Midi_Header(bytes);
+    if(Midi_Parse(midi, bytes))
+        return ERROR_NONE;
+    Midi_Free(midi);
+    return ERROR_CRASH;
+}
+
+static Error
+Midi_ReadStream(Midi* midi, FILE* file) // Midi_Read holding one window per track, regardless of file size.
+{
+    // Chunk layout is checked against the file size first, as Midi_Check does in memory.
+    fseek(file, 0, SEEK_END);
+    uint64_t size = ftell(file);
+    if(size < 14)
+    {
+        fprintf(stderr, "invalid midi file\n");
+        return ERROR_FILE;
+    }
+    Bytes header = Bytes_FromFileAt(file, 0, 14);
+    *midi = Midi_Header(&header);
+    bool valid = Bytes_U32(&header, 0) == 0x4D546864 && Midi_Division(midi->time_division);
+    Bytes_Free(&header);
+    uint64_t offset = 14;
+    for(uint32_t number = 0; valid && number < midi->track_count; number++)
+    {
+        valid = offset + 8 <= size;
+        if(valid)
         {
-            uint8_t type = Track_U8(track);
-            uint8_t value = Track_U8(track);
-            switch(type)
-            {
-                case 0x07:
-                    meta->volume[channel] = value / 127.0f;
-                    break;
-                default:
-                    break;
-            }
-            break;
+            midi->track[number] = Track_Stream(file, offset, number);
+            offset += 8 + (uint64_t) midi->track[number].size;
+            valid = midi->track[number].id == 0x4D54726B && offset <= size;
         }
-        // Program Change.
-        case 0xC:
+    }
+    if(!valid)
+    {
+        fprintf(stderr, "invalid midi file\n");
+        Midi_Free(midi);
+        return ERROR_FILE;
+    }
+    if(Midi_Parse(midi, NULL))
+        return ERROR_NONE;
+    Midi_Free(midi);
+    return ERROR_CRASH;
+}
+
+static Midi
+Midi_Init(Bytes* bytes) // For the modes playing a single file, which exit on a malformed one.
+{
+    Midi midi = { 0 };
+    Error error = Midi_Read(&midi, bytes);
+    if(error != ERROR_NONE)
+        exit(error);
+    return midi;
+}
+
+static Midi
+Midi_Stream(FILE* file)
+{
+    Midi midi = { 0 };
+    Error error = Midi_ReadStream(&midi, file);
+    if(error != ERROR_NONE)
+        exit(error);
+    return midi;
+}
+
+static uint64_t
+Midi_Events(Midi* midi)
+{
+    uint64_t events = 0;
+    for(uint32_t i = 0; i < midi->track_count; i++)
+        events += midi->track[i].events;
+    return events;
+}
+
+static bool
+Midi_Wait(uint64_t start, uint64_t sample, SDL_atomic_t* wake)
+{
+    // Waits on an absolute deadline so rounding never accumulates across events.
+    // Returns false if wake is raised first.
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t deadline = start
+        + sample / CONST_SAMPLE_FREQ * frequency
+        + sample % CONST_SAMPLE_FREQ * frequency / CONST_SAMPLE_FREQ;
+    while(!DONE)
+    {
+        if(wake && SDL_AtomicGet(wake))
+            return false;
+        uint64_t now = SDL_GetPerformanceCounter();
+        if(now >= deadline)
+            break;
+        uint64_t milliseconds = (deadline - now) * 1000 / frequency;
+        if(milliseconds == 0)
+            break;
+        SDL_Delay(milliseconds < 10 ? milliseconds : 10);
+    }
+    return true;
+}
+
+static bool
+Midi_Play(Midi* midi, Notes* notes, Meta* meta, uint64_t start, uint64_t offset, SDL_atomic_t* wake)
+{
+    // Start and offset place the song on a timeline shared by the whole playlist, in samples.
+    // Playing from the midi's current tick lets a song resume where a seek left it.
+    while(!DONE)
+    {
+        TRACE_BEGIN(wait);
+        bool woken = !Midi_Wait(start, offset + Tempos_Sample(&midi->tempos, midi->tick), wake);
+        TRACE_END(TRACE_MIDI, wait);
+        if(woken)
+            return false;
+        TRACE_BEGIN(step);
+        Midi_Step(midi, notes, meta);
+        TRACE_END(TRACE_MIDI, step);
+        if(Midi_Done(midi))
+            break;
+    }
+    return true;
+}
+
+static Events
+Midi_Compile(Midi* midi) // Records every channel message in playback order, then rewinds.
+{
+    Events events = { 0 };
+    Notes* scratch = calloc(1, sizeof(*scratch));
+    Meta meta = { 0 };
+    for(uint32_t i = 0; i < midi->track_count; i++)
+        midi->track[i].record = &events;
+    while(true)
+    {
+        Midi_Step(midi, scratch, &meta);
+        if(Midi_Done(midi))
+            break;
+    }
+    // A closing no-op keeps the length, which runs to the last end of track.
+    Message end = { 0, 0, 0 };
+    Events_Push(&events, midi->ticks, &end);
+    for(uint32_t i = 0; i < midi->track_count; i++)
+        midi->track[i].record = NULL;
+    free(scratch);
+    Midi_Rewind(midi);
+    return events;
+}
+
+static void
+Compiled_Path(char* path, char* dir, uint64_t hash)
+{
+    snprintf(path, CONST_COMPILED_PATH, "%s/%016llx.mmc", dir, (unsigned long long) hash);
+}
+
+static bool
+Compiled_Check(Compiled* compiled, Tempo* tempo, Event* event)
+{
+    // Everything playback divides by, indexes with or searches is checked, in one pass over the mapping.
+    if(compiled->scale == 0 || tempo[0].tick != 0 || tempo[0].time != 0)
+        return false;
+    for(uint32_t i = 1; i < compiled->tempo_count; i++)
+    {
+        Tempo* last = &tempo[i - 1];
+        if(tempo[i].tick <= last->tick || tempo[i].time != last->time + (tempo[i].tick - last->tick) * last->rate)
+            return false;
+    }
+    for(uint32_t i = 0; i < compiled->tempo_count; i++)
+        if(tempo[i].reserved != 0)
+            return false;
+    // Events are channel messages in tick order, closed by the no-op at the song's length.
+    for(uint32_t i = 0; i < compiled->event_count; i++)
+    {
+        Event* e = &event[i];
+        uint8_t status = e->leader >> 4;
+        bool message = status >= 0x8 && status <= 0xE;
+        bool end = i + 1 == compiled->event_count;
+        if(end ? e->leader != 0 || e->tick != compiled->ticks : !message)
+            return false;
+        if((e->a | e->b) >> 7 || e->tick > compiled->ticks || (i > 0 && e->tick < event[i - 1].tick))
+            return false;
+    }
+    return true;
+}
+
+static bool
+Compiled_Load(Song* song, uint64_t hash)
+{
+    // The mapping is used in place: the tempo map and events are never copied or decoded.
+    char path[CONST_COMPILED_PATH];
+    Compiled_Path(path, song->compiled, hash);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        return false;
+    struct stat info;
+    void* map = fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(Compiled)
+        ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED)
+        return false;
+    Compiled* compiled = map;
+    bool valid = compiled->magic == CONST_COMPILED_MAGIC
+        && compiled->version == CONST_COMPILED_VERSION
+        && compiled->hash == hash
+        && compiled->source_size == song->bytes.size
+        && compiled->tempo_size == sizeof(Tempo)
+        && compiled->event_size == sizeof(Event)
+        && compiled->tempo_count > 0
+        && compiled->event_count > 0
+        && sizeof(Compiled) + (uint64_t) compiled->tempo_count * sizeof(Tempo) + (uint64_t) compiled->event_count * sizeof(Event) == (uint64_t) info.st_size;
+    Tempo* tempo = (Tempo*) &compiled[1];
+    valid = valid
+        && compiled->checksum == Hash_Fnv(CONST_FNV_BASIS, tempo, info.st_size - sizeof(Compiled))
+        && Compiled_Check(compiled, tempo, (Event*) &tempo[compiled->tempo_count]);
+    if(!valid)
+    {
+        munmap(map, info.st_size);
+        return false;
+    }
+    song->midi = (Midi) { 0 };
+    song->midi.time_division = compiled->time_division;
+    song->midi.ticks = compiled->ticks;
+    song->midi.tempos = (Tempos) { tempo, compiled->tempo_count, compiled->scale };
+    song->midi.events = (Event*) &tempo[compiled->tempo_count];
+    song->midi.event_count = compiled->event_count;
+    song->map = map;
+    song->map_size = info.st_size;
+    return true;
+}
+
+static void
+Compiled_Save(Song* song, uint64_t hash)
+{
+    // Written aside and renamed into place, so a concurrent reader never maps half a file.
+    char path[CONST_COMPILED_PATH];
+    char temporary[CONST_COMPILED_PATH + 32];
+    Compiled_Path(path, song->compiled, hash);
+    snprintf(temporary, sizeof(temporary), "%s.%d", path, (int) getpid());
+    mkdir(song->compiled, 0755);
+    FILE* file = fopen(temporary, "wb");
+    if(file == NULL)
+    {
+        fprintf(stderr, "song cache: cannot write %s\n", temporary);
+        return;
+    }
+    Midi* midi = &song->midi;
+    Events events = Midi_Compile(midi);
+    uint64_t checksum = Hash_Fnv(CONST_FNV_BASIS, midi->tempos.tempo, midi->tempos.count * sizeof(Tempo));
+    checksum = Hash_Fnv(checksum, events.event, events.count * sizeof(Event));
+    Compiled compiled = {
+        CONST_COMPILED_MAGIC, CONST_COMPILED_VERSION, hash, checksum, song->bytes.size, midi->ticks, midi->tempos.scale,
+        midi->tempos.count, events.count, sizeof(Tempo), sizeof(Event), midi->time_division, 0
+    };
+    bool ok = fwrite(&compiled, sizeof(compiled), 1, file) == 1
+        && fwrite(midi->tempos.tempo, sizeof(Tempo), midi->tempos.count, file) == midi->tempos.count
+        && fwrite(events.event, sizeof(Event), events.count, file) == events.count;
+    ok &= fclose(file) == 0;
+    if(!ok || rename(temporary, path) != 0)
+    {
+        fprintf(stderr, "song cache: cannot write %s\n", path);
+        unlink(temporary);
+    }
+    free(events.event);
+}
+
+static int
+Song_Load(void* data)
+{
+    Song* song = data;
+    song->file = fopen(song->path, "rb");
+    if(song->file == NULL)
+    {
+        fprintf(stderr, "playlist: cannot open %s\n", song->path);
+        return 0;
+    }
+    if(!song->stream)
+        song->bytes = Bytes_FromFile(song->file);
+    // Compiled songs skip parsing. Streamed songs are never hashed, so they always parse.
+    uint64_t hash = song->compiled && !song->stream ? Bytes_Hash(&song->bytes) : 0;
+    if(song->compiled && !song->stream && Compiled_Load(song, hash))
+    {
+        Bytes_Free(&song->bytes);
+        song->ok = true;
+        return 0;
+    }
+    // The song playing meanwhile must survive a malformed next entry, so it is reported and skipped.
+    Error error = song->stream ? Midi_ReadStream(&song->midi, song->file) : Midi_Read(&song->midi, &song->bytes);
+    if(error != ERROR_NONE)
+    {
+        fprintf(stderr, "playlist: skipping malformed %s\n", song->path);
+        return 0;
+    }
+    if(song->compiled && !song->stream)
+        Compiled_Save(song, hash);
+    song->ok = true;
+    return 0;
+}
+
+static Song
+Song_Init(char* path, bool stream, char* compiled)
+{
+    Song song = { 0 };
+    song.path = path;
+    song.compiled = compiled;
+    song.stream = stream;
+    return song;
+}
+
+static int
+Song_Fetch(void* data)
+{
+    Song* song = data;
+    Realtime_Worker(song->rt, 0, "prefetch");
+    return Song_Load(song);
+}
+
+static void
+Song_Prefetch(Song* song, Realtime* rt) // Loads and parses on a background thread until Song_Wait.
+{
+    song->rt = rt;
+    song->thread = SDL_CreateThread(Song_Fetch, "MIDI-PREFETCH", song);
+}
+
+static void
+Song_Wait(Song* song)
+{
+    SDL_WaitThread(song->thread, NULL);
+    song->thread = NULL;
+}
+
+static void
+Song_Free(Song* song)
+{
+    if(song->map)
+        munmap(song->map, song->map_size);
+    else if(song->ok)
+        Midi_Free(&song->midi);
+    song->map = NULL;
+    Bytes_Free(&song->bytes);
+    if(song->file)
+        fclose(song->file);
+    song->file = NULL;
+    song->ok = false;
+}
+
+static bool
+Cache_Render(Cache* cache, Render* render) // False if a write fails or a streamed file changed on disk.
+{
+    jmp_buf crash;
+    Midi_Target(render->midi, &crash);
+    if(setjmp(crash))
+    {
+        Midi_Target(render->midi, NULL);
+        return false;
+    }
+    bool ok = true;
+    uint64_t frames = cache->size / cache->channels;
+    while(ok && render->frame < frames && !render->done && !DONE)
+    {
+        uint64_t end = render->frame + CONST_SAMPLE_FREQ < frames ? render->frame + CONST_SAMPLE_FREQ : frames;
+        int16_t* pcm = cache->data ? &cache->data[render->frame * cache->channels] : NULL;
+        ok = Render_Run(render, end, pcm, cache->spill, false);
+    }
+    Midi_Target(render->midi, NULL);
+    return ok;
+}
+
+static int
+Cache_Fill(void* data)
+{
+    // Renders exactly the song's frames from its first, whatever the governor did to the live pass.
+    Cache* cache = data;
+    Realtime_Worker(cache->song.rt, 1, "loop render");
+    Song_Load(&cache->song);
+    bool ok = cache->song.ok;
+    Notes* notes = calloc(1, sizeof(*notes));
+    Notes* modus = calloc(1, sizeof(*modus));
+    Meta meta = { 0 };
+    Notes_Setup(modus);
+    Synth synth = Synth_Init(cache->engine);
+    Render render = { &cache->song.midi, notes, modus, &meta, cache->channels, &synth, 0, 0, 0, false };
+    ok = ok && Cache_Render(cache, &render);
+    if(ok && !DONE)
+    {
+        if(cache->spill)
+            rewind(cache->spill);
+        SDL_AtomicSet(&cache->filled, true);
+    }
+    else
+        fprintf(stderr, "loop: cannot render %s\n", cache->song.path);
+    Song_Free(&cache->song);
+    free(notes);
+    free(modus);
+    return 0;
+}
+
+static void
+Cache_Start(Cache* cache, Song song, Engine engine, Realtime* rt) // Song is loaded again by the render thread.
+{
+    cache->song = song;
+    cache->song.rt = rt;
+    cache->engine = engine;
+    cache->thread = SDL_CreateThread(Cache_Fill, "MIDI-LOOP-RENDER", cache);
+}
+
+static void
+Notes_Release(Notes* notes) // Note Off for every note, so tails still ring out.
+{
+    for(uint32_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+        for(uint32_t note = 0; note < CONST_NOTES_MAX; note++)
+            notes->note[channel][note].gain_setpoint = 0;
+}
+
+static bool
+Song_Play(Song* song, Notes* notes, Meta* meta, uint64_t start, uint64_t offset) // False if the song stopped early.
+{
+    // A streamed song reads its file again while playing, so a file changed on disk stops the song here.
+    jmp_buf crash;
+    Midi_Target(&song->midi, &crash);
+    if(setjmp(crash))
+    {
+        fprintf(stderr, "playlist: %s changed during playback\n", song->path);
+        Midi_Target(&song->midi, NULL);
+        Notes_Release(notes);
+        return false;
+    }
+    Midi_Play(&song->midi, notes, meta, start, offset, NULL);
+    Midi_Target(&song->midi, NULL);
+    return true;
+}
+
+static void
+Playlist_Play(Args* args, Song* song, Notes* notes, Meta* meta, bool again) // Again loops a single song by playing it again.
+{
+    // Each song starts on the sample the previous one ended on. Voices and the audio
+    // device carry across, so tails ring into the next song as within one song.
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint64_t offset = 0;
+    int failures = 0;
+    for(int i = 0; !DONE; i++)
+    {
+        int next = i + 1;
+        bool more = next < args->song_count || (args->loop && (args->song_count > 1 || again));
+        Song upcoming = Song_Init(args->songs[next % args->song_count], args->stream, args->compiled);
+        if(more)
+            Song_Prefetch(&upcoming, &args->rt);
+        if(song->ok)
         {
-            uint8_t program = Track_U8(track);
-            meta->instruments[channel] = program;
+            // Channel state resets, so each song sounds as it does alone.
+            if(i > 0)
+                *meta = (Meta) { 0 };
+            // A song stopped early hands over from where it stopped.
+            bool played = Song_Play(song, notes, meta, start, offset);
+            offset += Tempos_Sample(&song->midi.tempos, played ? song->midi.ticks : song->midi.tick);
+            failures = played ? 0 : failures + 1;
+        }
+        else
+            failures += 1;
+        Song_Free(song);
+        if(more)
+            Song_Wait(&upcoming);
+        *song = upcoming;
+        if(!more || failures == args->song_count)
             break;
+    }
+    Song_Free(song);
+}
+
+static uint64_t
+Watch_Now(uint64_t start) // Samples since start.
+{
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+    return elapsed / frequency * CONST_SAMPLE_FREQ + elapsed % frequency * CONST_SAMPLE_FREQ / frequency;
+}
+
+static uint64_t
+Tempos_Tick(Tempos* tempos, uint64_t sample) // Inverse of Tempos_Sample, rounding down.
+{
+    uint64_t time = sample / CONST_SAMPLE_FREQ * tempos->scale + sample % CONST_SAMPLE_FREQ * tempos->scale / CONST_SAMPLE_FREQ;
+    uint32_t lo = 0;
+    uint32_t hi = tempos->count;
+    while(hi - lo > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if(tempos->tempo[mid].time <= time)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    Tempo* tempo = &tempos->tempo[lo];
+    return tempo->rate == 0 ? tempo->tick : tempo->tick + (time - tempo->time) / tempo->rate;
+}
+
+static bool
+Watch_Parse(Watch* watch, Song* song, Notes* scratch)
+{
+    if(setjmp(watch->crash))
+        return false;
+    Midi_Load(&song->midi, &song->bytes, scratch, &watch->crash);
+    return true;
+}
+
+static bool
+Watch_Load(Watch* watch, Song* song)
+{
+    // A file caught half written is rejected instead of ending playback.
+    FILE* file = fopen(song->path, "rb");
+    if(file == NULL)
+        return false;
+    song->bytes = Bytes_FromFile(file);
+    fclose(file);
+    if(!Midi_Check(&song->bytes))
+        return false;
+    Notes* scratch = calloc(1, sizeof(*scratch));
+    song->midi = Midi_Header(&song->bytes);
+    song->ok = Watch_Parse(watch, song, scratch);
+    free(scratch);
+    if(!song->ok)
+    {
+        Midi_Free(&song->midi);
+        return false;
+    }
+    // The full parse already ran every event, so playback never needs the crash target.
+    for(uint32_t i = 0; i < song->midi.track_count; i++)
+        song->midi.track[i].crash = NULL;
+    return true;
+}
+
+static bool
+Watch_Changed(Watch* watch, int timeout)
+{
+    // Editors either rewrite the file or rename a new one over it, so the directory is watched.
+    struct pollfd fds = { watch->fd, POLLIN, 0 };
+    if(poll(&fds, 1, timeout) <= 0)
+        return false;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t size = read(watch->fd, buffer, sizeof(buffer));
+    bool changed = false;
+    for(ssize_t at = 0; at < size; )
+    {
+        struct inotify_event* event = (struct inotify_event*) &buffer[at];
+        if(event->len > 0 && strcmp(event->name, watch->name) == 0)
+            changed = true;
+        at += sizeof(*event) + event->len;
+    }
+    return changed;
+}
+
+static int
+Watch_Run(void* data)
+{
+    Watch* watch = data;
+    while(!DONE)
+    {
+        if(!Watch_Changed(watch, CONST_WATCH_POLL))
+            continue;
+        // Exports land in several writes. Wait for a quiet moment before reading.
+        while(Watch_Changed(watch, CONST_WATCH_SETTLE))
+            continue;
+        Song song = Song_Init(watch->path, false, NULL);
+        if(!Watch_Load(watch, &song))
+        {
+            fprintf(stderr, "watch: %s is not a valid MIDI file yet, keeping the current one\n", watch->path);
+            Song_Free(&song);
+            continue;
         }
-        // Channel Aftertouch.
-        case 0xD:
+        while(SDL_AtomicGet(&watch->ready) && !DONE)
+            SDL_Delay(10);
+        watch->song = song;
+        SDL_AtomicSet(&watch->ready, true);
+    }
+    return 0;
+}
+
+static Watch
+Watch_Init(char* path)
+{
+    Watch watch = { 0 };
+    watch.path = path;
+    char* slash = strrchr(path, '/');
+    watch.dir = slash ? strndup(path, slash - path + 1) : strdup(".");
+    watch.name = slash ? slash + 1 : path;
+    watch.fd = inotify_init1(IN_CLOEXEC);
+    if(watch.fd == -1 || inotify_add_watch(watch.fd, watch.dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+    {
+        fprintf(stderr, "watch: cannot watch %s\n", watch.dir);
+        exit(ERROR_FILE);
+    }
+    return watch;
+}
+
+static void
+Watch_Start(Watch* watch)
+{
+    watch->thread = SDL_CreateThread(Watch_Run, "MIDI-WATCH", watch);
+}
+
+static void
+Watch_Free(Watch* watch)
+{
+    SDL_WaitThread(watch->thread, NULL);
+    if(SDL_AtomicGet(&watch->ready))
+        Song_Free(&watch->song);
+    close(watch->fd);
+    free(watch->dir);
+}
+
+static uint64_t
+Watch_Seek(Song* next, Song* song, uint64_t sample, Notes* held, Meta* meta)
+{
+    // Keeps the musical position: beats when both files count ticks per quarter note, else time.
+    // Events before it only set up channel state and held notes. Returns where next resumes, in samples.
+    uint16_t from = song->midi.time_division;
+    uint16_t to = next->midi.time_division;
+    uint64_t tick = Tempos_Tick(&song->midi.tempos, sample);
+    tick = (from & 0x8000) == 0 && (to & 0x8000) == 0
+        ? tick * to / from
+        : Tempos_Tick(&next->midi.tempos, sample);
+    while(!Midi_Done(&next->midi) && next->midi.tick < tick)
+        Midi_Step(&next->midi, held, meta);
+    return Tempos_Sample(&next->midi.tempos, next->midi.tick < tick ? next->midi.tick : tick);
+}
+
+static void
+Watch_Swap(Notes* notes, Notes* held, Meta* meta, Meta* chased)
+{
+    // Every sounding voice releases. Notes held at the new position sound on, keys held
+    // in both files without a retrigger.
+    for(uint8_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+        for(uint32_t note_index = 0; note_index < CONST_NOTES_MAX; note_index++)
         {
-            Track_U8(track);
-            break;
+            Note* note = &notes->note[channel][note_index];
+            Note* hold = &held->note[channel][note_index];
+            note->gain_setpoint = hold->gain_setpoint;
+            if(hold->gain_setpoint > 0)
+                note->on = true;
         }
-        // Pitch Bend.
-        case 0xE:
+    *meta = *chased;
+}
+
+static void
+Watch_Play(Watch* watch, Song* song, Notes* notes, Meta* meta, bool loop)
+{
+    // Plays until quit. A reload swaps songs between sequencer steps, at the same position,
+    // while the audio device keeps running.
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint64_t offset = 0;
+    bool playing = song->ok;
+    Notes* held = calloc(1, sizeof(*held));
+    while(!DONE)
+    {
+        if(playing && Midi_Play(&song->midi, notes, meta, start, offset, &watch->ready))
         {
-            uint8_t lsb = Track_U8(track);
-            uint8_t msb = Track_U8(track);
-            uint16_t bend = (msb << 7) | lsb;
-            meta->bend[channel] = bend;
+            offset += Tempos_Sample(&song->midi.tempos, song->midi.ticks);
+            playing = loop;
+            if(loop)
+            {
+                Midi_Rewind(&song->midi);
+                *meta = (Meta) { 0 };
+                continue;
+            }
+        }
+        while(!DONE && !SDL_AtomicGet(&watch->ready))
+            SDL_Delay(10);
+        if(DONE)
             break;
+        // A song that has ended starts over from the top.
+        Song* next = &watch->song;
+        Meta chased = { 0 };
+        memset(held, 0, sizeof(*held));
+        uint64_t now = Watch_Now(start);
+        uint64_t at = playing && now > offset ? Watch_Seek(next, song, now - offset, held, &chased) : 0;
+        Watch_Swap(notes, held, meta, &chased);
+        offset = now - at;
+        fprintf(stderr, "watch: reloaded %s at %.2f s\n", song->path, at / (double) CONST_SAMPLE_FREQ);
+        Song_Free(song);
+        *song = *next;
+        playing = true;
+        SDL_AtomicSet(&watch->ready, false);
+    }
+    free(held);
+}
+
+static int
+Producer_Run(void* data)
+{
+    // Sequences off the main thread, which SDL keeps for video and events.
+    Producer* producer = data;
+    Args* args = producer->args;
+    if(args->watch)
+    {
+        Watch watch = Watch_Init(args->path);
+        Watch_Start(&watch);
+        Watch_Play(&watch, producer->song, producer->notes, producer->meta, args->loop);
+        Watch_Free(&watch);
+    }
+    else if(args->file)
+    {
+        // A single looping song plays once live, then its offline render replays.
+        Cache* cache = producer->cache;
+        bool cached = cache->size > 0;
+        Playlist_Play(args, producer->song, producer->notes, producer->meta, !cached);
+        if(cached && !DONE)
+        {
+            SDL_WaitThread(cache->thread, NULL);
+            cache->thread = NULL;
+            if(SDL_AtomicGet(&cache->filled))
+                SDL_AtomicSet(&cache->played, true);
+            else
+            {
+                // Without a render the loop falls back to parsing and playing again.
+                *producer->song = Song_Init(args->path, args->stream, args->compiled);
+                Song_Load(producer->song);
+                Playlist_Play(args, producer->song, producer->notes, producer->meta, true);
+            }
         }
+        if(!args->loop || args->song_count > 1)
+            DONE = true;
+    }
+    return 0;
+}
+
+static uint64_t
+Midi_Render(Midi* midi, Notes* notes, Notes* modus, Meta* meta, FILE* out, uint64_t frames_max, uint32_t channels, Synth* synth)
+{
+    Render render = { midi, notes, modus, meta, channels, synth, 0, 0, 0, false };
+    Render_Run(&render, frames_max, NULL, out, false);
+    return render.voices;
+}
+
+static Midi
+Midi_Clone(Midi* midi) // Shares track data and the tempo map, which are read only during playback.
+{
+    Midi clone = *midi;
+    clone.track = malloc(midi->track_count * sizeof(*clone.track));
+    clone.heap = malloc(midi->track_count * sizeof(*clone.heap));
+    memcpy(clone.track, midi->track, midi->track_count * sizeof(*clone.track));
+    memcpy(clone.heap, midi->heap, midi->track_count * sizeof(*clone.heap));
+    return clone;
+}
+
+static void
+Midi_FreeClone(Midi* clone)
+{
+    free(clone->track);
+    free(clone->heap);
+}
+
+static int
+Segment_Run(void* data)
+{
+    Segment* segment = data;
+    Realtime_Worker(segment->rt, segment->number, "render segment");
+    Render_Run(&segment->render, segment->end, NULL, segment->out, false);
+    return 0;
+}
+
+static uint64_t
+Midi_RenderParallel(Midi* midi, FILE* out, uint32_t channels, Synth* synth, int threads, Realtime* rt)
+{
+    // A state only pass hands each segment the exact voice, meta and sequencer state
+    // at its first frame, so stitched segments equal a sequential render.
+    uint64_t frames = Tempos_Sample(&midi->tempos, midi->ticks);
+    Notes* notes = calloc(1, sizeof(*notes));
+    Notes* modus = calloc(1, sizeof(*modus));
+    Meta meta = { 0 };
+    Notes_Setup(modus);
+    Render state = { midi, notes, modus, &meta, channels, synth, 0, 0, 0, false };
+    Segment* segment = calloc(threads, sizeof(*segment));
+    for(int i = 0; i < threads; i++)
+    {
+        Segment* s = &segment[i];
+        s->end = frames * (i + 1) / threads;
+        s->midi = Midi_Clone(midi);
+        s->notes = malloc(sizeof(*s->notes));
+        s->modus = malloc(sizeof(*s->modus));
+        *s->notes = *notes;
+        *s->modus = *modus;
+        s->meta = meta;
+        s->render = state;
+        s->render.midi = &s->midi;
+        s->render.notes = s->notes;
+        s->render.modus = s->modus;
+        s->render.meta = &s->meta;
+        s->out = tmpfile();
+        s->rt = rt;
+        s->number = i;
+        s->thread = SDL_CreateThread(Segment_Run, "MIDI-RENDER-SEGMENT", s);
+        if(i + 1 < threads)
+            Render_Run(&state, s->end, NULL, NULL, true);
+    }
+    uint64_t voices = 0;
+    for(int i = 0; i < threads; i++)
+    {
+        Segment* s = &segment[i];
+        SDL_WaitThread(s->thread, NULL);
+        voices += s->render.voices;
+        rewind(s->out);
+        int16_t mixes[CONST_RENDER_SAMPLES];
+        size_t count;
+        while((count = fread(mixes, sizeof(*mixes), CONST_RENDER_SAMPLES, s->out)) > 0)
+            fwrite(mixes, sizeof(*mixes), count, out);
+        fclose(s->out);
+        Midi_FreeClone(&s->midi);
+        free(s->notes);
+        free(s->modus);
     }
+    free(segment);
+    free(notes);
+    free(modus);
+    return voices;
+}
+
+static double
+Bench_Seconds(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) / (double) SDL_GetPerformanceFrequency();
 }
 
 static void
-Track_MetaEvent(Track* track, Meta* meta)
+Json_Print(const char* string) // Quoted, so paths holding quotes, backslashes or control bytes stay valid JSON.
 {
-    switch(Track_U8(track))
+    putchar('"');
+    for(const unsigned char* c = (const unsigned char*) string; *c; c++)
     {
-        default:
-        {
-            Track_Crash(track);
-            break;
-        }
-        // Sequence Number.
-        case 0x00:
-        {
-            Track_Spin(track, 3);
-            break;
-        }
-        case 0x01: // Text Event.
-        case 0x02: // Copyright Notice.
-        case 0x03: // Track Name.
-        case 0x04: // Instrument Name.
-        case 0x05: // Lyric.
-        case 0x06: // Marker.
-        case 0x07: // Cue Point.
-        case 0x08: // Program Name.
-        case 0x09: // Device Name.
-        {
-            free(Track_Str(track));
-            break;
-        }
-        // Channel Prefix.
-        case 0x20:
-        {
-            Track_Spin(track, 2);
-            break;
-        }
-        // Midi Port.
-        case 0x21:
-        {
-            Track_Spin(track, 2);
-            break;
-        }
-        // End of Track.
-        case 0x2F:
-        {
-            track->run = Track_U8(track);
-            break;
-        }
-        // Tempo.
-        case 0x51:
-        {
-            Track_U8(track);
-            uint8_t a = Track_U8(track);
-            uint8_t b = Track_U8(track);
-            uint8_t c = Track_U8(track);
-            meta->tempo = (a << 16) | (b << 8) | c;
-            break;
-        }
-        // SMPTE Offset.
-        case 0X54:
-        {
-            Track_Spin(track, 6);
-            break;
-        }
-        // Time Signature.
-        case 0x58:
-        {
-            Track_Spin(track, 5);
-            break;
-        }
-        // Key Signature.
-        case 0x59:
+        if(*c == '"' || *c == '\\')
+            printf("\\%c", *c);
+        else if(*c < 0x20)
+            printf("\\u%04x", *c);
+        else
+            putchar(*c);
+    }
+    putchar('"');
+}
+
+static void
+Bench_Run(Args* args)
+{
+    Bytes bytes = Bytes_FromFile(args->file);
+    Notes* notes = calloc(1, sizeof(*notes));
+    Notes* modus = calloc(1, sizeof(*modus));
+    Meta meta = { 0 };
+    // Map - tracks copied and sequenced once for the tempo map, which every later phase reuses.
+    uint64_t start = SDL_GetPerformanceCounter();
+    Midi midi = Midi_Init(&bytes);
+    double map_seconds = Bench_Seconds(start);
+    // Parse - every track decoded end to end, no interleaving.
+    start = SDL_GetPerformanceCounter();
+    for(uint32_t i = 0; i < midi.track_count; i++)
+        Track_Drain(&midi.track[i], notes, &meta);
+    double parse_seconds = Bench_Seconds(start);
+    uint64_t events = Midi_Events(&midi);
+    // Sequence - tracks interleaved in time, no waiting.
+    Midi_Rewind(&midi);
+    memset(notes, 0, sizeof(*notes));
+    meta = (Meta) { 0 };
+    start = SDL_GetPerformanceCounter();
+    do Midi_Step(&midi, notes, &meta);
+    while(!Midi_Done(&midi));
+    double sequence_seconds = Bench_Seconds(start);
+    // Synth - offline render of the opening seconds.
+    Midi_Rewind(&midi);
+    memset(notes, 0, sizeof(*notes));
+    memset(modus, 0, sizeof(*modus));
+    Notes_Setup(modus);
+    meta = (Meta) { 0 };
+    Synth synth = Synth_Init(args->engine);
+    start = SDL_GetPerformanceCounter();
+    uint64_t voices = Midi_Render(&midi, notes, modus, &meta, NULL, CONST_BENCH_SECONDS * CONST_SAMPLE_FREQ, 2, &synth);
+    double synth_seconds = Bench_Seconds(start);
+    double voice_seconds = voices / (double) CONST_SAMPLE_FREQ;
+    printf("{\"file\": ");
+    Json_Print(args->path);
+    printf(", \"bytes\": %u, \"tracks\": %u, \"events\": %lu, \"map_events_per_sec\": %.0f, "
+           "\"parse_events_per_sec\": %.0f, \"parse_bytes_per_sec\": %.0f, \"sequencer_events_per_sec\": %.0f, "
+           "\"synth_voice_seconds\": %.3f, \"synth_voice_seconds_per_sec\": %.3f}\n",
+        bytes.size, midi.track_count, (unsigned long) events, events / map_seconds,
+        events / parse_seconds, bytes.size / parse_seconds, events / sequence_seconds,
+        voice_seconds, voice_seconds / synth_seconds);
+    Midi_Free(&midi);
+    free(notes);
+    free(modus);
+    Bytes_Free(&bytes);
+}
+
+static bool
+Analyze_Parse(Midi* midi, Bytes* bytes, Notes* scratch, jmp_buf* crash)
+{
+    if(setjmp(*crash))
+        return false;
+    Midi_Load(midi, bytes, scratch, crash);
+    return true;
+}
+
+static bool
+Analyze_Print(char* path, Midi* midi, Events* events)
+{
+    // Voices are counted as held keys, one per key as in the synth. Release tails are not counted.
+    uint64_t samples = Tempos_Sample(&midi->tempos, midi->ticks);
+    double duration = samples / (double) CONST_SAMPLE_FREQ;
+    uint64_t seconds = samples / CONST_SAMPLE_FREQ + 1;
+    uint64_t width = (seconds + CONST_ANALYZE_BUCKETS - 1) / CONST_ANALYZE_BUCKETS;
+    uint32_t buckets = (seconds + width - 1) / width;
+    uint32_t* profile = calloc(buckets, sizeof(*profile));
+    if(profile == NULL)
+        return false;
+    bool on[CONST_CHANNEL_MAX][CONST_NOTES_MAX] = { { false } };
+    uint32_t held[CONST_CHANNEL_MAX] = { 0 };
+    uint32_t peak[CONST_CHANNEL_MAX] = { 0 };
+    uint32_t total = 0;
+    uint32_t peak_total = 0;
+    // The closing no-op from Midi_Compile is not a message.
+    uint32_t messages = events->count - 1;
+    for(uint32_t i = 0; i < messages; i++)
+    {
+        Event* event = &events->event[i];
+        uint8_t status = event->leader >> 4;
+        uint8_t channel = event->leader & 0xF;
+        profile[Tempos_Sample(&midi->tempos, event->tick) / CONST_SAMPLE_FREQ / width] += 1;
+        if((status != 0x8 && status != 0x9) || IsPercussive(channel) || event->a >= CONST_NOTES_MAX)
+            continue;
+        bool start = status == 0x9 && event->b > 0;
+        bool* note = &on[channel][event->a];
+        if(start && !*note)
         {
-            Track_Spin(track, 3);
-            break;
+            held[channel] += 1;
+            total += 1;
+            if(held[channel] > peak[channel])
+                peak[channel] = held[channel];
+            if(total > peak_total)
+                peak_total = total;
         }
-        case 0xF0: // Sysex Start.
-        case 0xF7: // Sysex End.
-        case 0x7F: // Systex Running Status.
+        else if(!start && *note)
         {
-            Bytes bytes = Track_Bytes(track);
-            Bytes_Free(&bytes);
-            break;
+            held[channel] -= 1;
+            total -= 1;
         }
+        *note = start;
     }
+    uint32_t busiest = 0;
+    for(uint32_t bucket = 0; bucket < buckets; bucket++)
+        if(profile[bucket] > busiest)
+            busiest = profile[bucket];
+    // Rates average over the bucket width, which is one second for songs under 18 hours.
+    printf("{\"file\": ");
+    Json_Print(path);
+    printf(", \"duration_seconds\": %.3f, \"ticks\": %lu, \"events\": %u, "
+           "\"events_per_sec_mean\": %.1f, \"events_per_sec_peak\": %.10g, \"peak_voices\": %u, \"peak_voices_per_channel\": [",
+        duration, (unsigned long) midi->ticks, messages,
+        duration > 0.0 ? messages / duration : 0.0, busiest / (double) width, peak_total);
+    for(uint8_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+        printf("%s%u", channel > 0 ? ", " : "", peak[channel]);
+    printf("], \"events_per_sec_width\": %lu, \"events_per_sec\": [", (unsigned long) width);
+    for(uint32_t bucket = 0; bucket < buckets; bucket++)
+        printf("%s%.10g", bucket > 0 ? ", " : "", profile[bucket] / (double) width);
+    printf("]}\n");
+    free(profile);
+    return true;
 }
 
-static void
-Track_Play(Track* track, Notes* notes, Meta* meta)
+static bool
+Analyze_File(char* path, Notes* scratch, jmp_buf* crash)
 {
-    int end = -1;
-    if(track->run)
+    // Parses and sequences without audio, video or waiting. A bad file only fails its own line.
+    FILE* file = fopen(path, "rb");
+    if(file == NULL)
+    {
+        printf("{\"file\": ");
+        Json_Print(path);
+        printf(", \"error\": \"cannot open\"}\n");
+        return false;
+    }
+    Bytes bytes = Bytes_FromFile(file);
+    fclose(file);
+    char* error = Midi_Check(&bytes) ? NULL : "malformed";
+    if(error == NULL)
     {
-        if(track->delay > end)
-            track->delay -= 1;
-        if(track->delay == end)
-            track->delay = Track_Var(track);
-        if(track->delay == 0)
+        Midi midi = Midi_Header(&bytes);
+        if(!Analyze_Parse(&midi, &bytes, scratch, crash))
+            error = "malformed";
+        else
         {
-            uint8_t leader = Track_U8(track);
-            leader == 0xFF
-                ? Track_MetaEvent(track, meta)
-                : Track_RealEvent(track, meta, notes, leader);
-            // Notes with zero delay must immediately process
-            // the next note before moving onto the next track.
-            Track_Play(track, notes, meta);
+            Events events = Midi_Compile(&midi);
+            if(!Analyze_Print(path, &midi, &events))
+                error = "out of memory";
+            free(events.event);
         }
+        Midi_Free(&midi);
+    }
+    if(error)
+    {
+        printf("{\"file\": ");
+        Json_Print(path);
+        printf(", \"error\": \"%s\"}\n", error);
     }
+    Bytes_Free(&bytes);
+    return error == NULL;
 }
 
-static Track
-Track_Init(Bytes* bytes, uint32_t offset, uint32_t number)
+static bool
+Analyze_Run(Args* args)
 {
-    Track track = { 0 };
-    track.id = Bytes_U32(bytes, offset);
-    track.size = Bytes_U32(bytes, offset + 4);
-    track.data = calloc(track.size, sizeof(*track.data));
-    track.run = true;
-    track.number = number;
-    for(uint32_t i = 0; i < track.size; i++)
-        track.data[i] = Bytes_U8(bytes, offset + 8 + i);
-    return track;
+    Notes* scratch = calloc(1, sizeof(*scratch));
+    jmp_buf crash;
+    int failed = 0;
+    uint64_t start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < args->song_count; i++)
+        failed += !Analyze_File(args->songs[i], scratch, &crash);
+    double seconds = Bench_Seconds(start);
+    fprintf(stderr, "analyze: %d files, %d failed, %.0f files/sec\n",
+        args->song_count, failed, args->song_count / seconds);
+    free(scratch);
+    return failed == 0;
 }
 
-static Audio
-Audio_Init(void)
+static void
+Midi_Changed(void) // For the modes rendering a single streamed file, which exit when it changes on disk.
 {
-    Audio audio = { 0 };
-    audio.spec.freq = CONST_SAMPLE_FREQ;
-    audio.spec.format = AUDIO_S16SYS;
-    audio.spec.channels = 2;
-    audio.spec.samples = 1024;
-    audio.spec.callback = NULL;
-    audio.dev = SDL_OpenAudioDevice(NULL, 0, &audio.spec, NULL, 0);
-    return audio;
+    fprintf(stderr, "stream: file changed during render\n");
+    exit(ERROR_CRASH);
+}
+
+static uint64_t
+Midi_RenderFile(FILE* file, bool stream, Engine engine, int threads, FILE* out, Realtime* rt) // Rt may be NULL.
+{
+    Notes* notes = calloc(1, sizeof(*notes));
+    Notes* modus = calloc(1, sizeof(*modus));
+    Meta meta = { 0 };
+    Notes_Setup(modus);
+    Bytes bytes = { 0 };
+    if(!stream)
+        bytes = Bytes_FromFile(file);
+    Midi midi = stream ? Midi_Stream(file) : Midi_Init(&bytes);
+    Synth synth = Synth_Init(engine);
+    jmp_buf crash;
+    if(stream)
+    {
+        Midi_Target(&midi, &crash);
+        if(setjmp(crash))
+            Midi_Changed();
+    }
+    // Streamed tracks share one window per track, so they render sequentially.
+    uint64_t voices = threads > 1 && !stream
+        ? Midi_RenderParallel(&midi, out, 2, &synth, threads, rt)
+        : Midi_Render(&midi, notes, modus, &meta, out, UINT64_MAX, 2, &synth);
+    Midi_Free(&midi);
+    Bytes_Free(&bytes);
+    free(notes);
+    free(modus);
+    return voices;
 }
 
+// Every channel on its own bus.
+static const uint8_t STEM_ROUTE[CONST_CHANNEL_MAX] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+
 static void
-Audio_Free(Audio* audio)
+Stem_Write(Stem* stem, int16_t* frames, uint32_t count)
 {
-    SDL_CloseAudioDevice(audio->dev);
+    if(fwrite(frames, sizeof(*frames), count, stem->file) != count)
+    {
+        fprintf(stderr, "stems: %s: write failed\n", stem->path);
+        exit(ERROR_FILE);
+    }
 }
 
-static int
-Audio_Play(void* data)
+static void
+Stem_Open(Stem* stem, Stems* stems)
 {
-    Consumer* consumer = data;
-    for(int32_t cycles = 0; !DONE; cycles++)
+    stem->file = fopen(stem->path, "wb");
+    if(stem->file == NULL)
     {
-        uint32_t queue_size = SDL_GetQueuedAudioSize(consumer->audio->dev);
-        uint32_t samples = consumer->audio->spec.samples;
-        uint32_t thresh_min = 3 * consumer->audio->spec.samples;
-        uint32_t thresh_max = 5 * consumer->audio->spec.samples;
-        SDL_PauseAudioDevice(consumer->audio->dev, queue_size < thresh_min);
-        if(queue_size < thresh_max)
+        fprintf(stderr, "stems: cannot open %s\n", stem->path);
+        exit(ERROR_FILE);
+    }
+    Wav_Header(stem->file, stems->channels, 0);
+    // A channel first heard late is padded with the silence it skipped.
+    memset(stems->frames, 0, CONST_STEM_FRAMES * stems->channels * sizeof(*stems->frames));
+    for(uint64_t frame = 0; frame < stems->written; frame += CONST_STEM_FRAMES)
+    {
+        uint64_t count = stems->written - frame < CONST_STEM_FRAMES ? stems->written - frame : CONST_STEM_FRAMES;
+        Stem_Write(stem, stems->frames, count * stems->channels);
+    }
+}
+
+static Stems
+Stems_Init(char* dir, uint32_t channels, Engine engine)
+{
+    Stems stems = { 0 };
+    stems.channels = channels;
+    stems.engine = engine;
+    stems.parts = calloc((CONST_CHANNEL_MAX + 1) * CONST_STEM_FRAMES, sizeof(*stems.parts));
+    stems.frames = calloc(CONST_STEM_FRAMES * channels, sizeof(*stems.frames));
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "stems: cannot create %s\n", dir);
+        exit(ERROR_FILE);
+    }
+    for(uint32_t i = 0; i < CONST_CHANNEL_MAX; i++)
+        snprintf(stems.stem[i].path, CONST_STEM_PATH, "%s/channel-%02u.wav", dir, i + 1);
+    snprintf(stems.stem[CONST_CHANNEL_MAX].path, CONST_STEM_PATH, "%s/master.wav", dir);
+    return stems;
+}
+
+static void
+Stems_Flush(Stems* stems)
+{
+    // The master is the plain sum of the channel buses, exactly what Audio_Mix puts on its one bus.
+    int32_t* master = &stems->parts[CONST_CHANNEL_MAX * CONST_STEM_FRAMES];
+    for(uint32_t frame = 0; frame < stems->fill; frame++)
+    {
+        master[frame] = 0;
+        for(uint32_t i = 0; i < CONST_CHANNEL_MAX; i++)
+            master[frame] += stems->parts[i * CONST_STEM_FRAMES + frame];
+    }
+    for(uint32_t i = 0; i <= CONST_CHANNEL_MAX; i++)
+    {
+        Stem* stem = &stems->stem[i];
+        int32_t* part = &stems->parts[i * CONST_STEM_FRAMES];
+        if(stem->file == NULL)
         {
-            uint32_t mixes_size = sizeof(int16_t) * samples;
-            int16_t* mixes = malloc(mixes_size);
-            for(uint32_t sample = 0; sample < samples; sample += consumer->audio->spec.channels)
-            {
-                int16_t mix = 0;
-                for(uint32_t note_index = 0; note_index < CONST_NOTES_MAX; note_index++)
-                {
-                    for(uint8_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
-                    {
-                        Note* note = &consumer->notes->note[channel][note_index];
-                        Note* modu = &consumer->modus->note[channel][note_index];
-                        if(note->on)
-                        {
-                            Note_Process(note);
-                            Note_Process(modu);
-                            bool audible = note->gain > 0;
-                            if(audible)
-                            {
-                                int bank = Meta_GetBank(consumer->meta, channel);
-                                Wave wave = { modu, consumer->meta, channel, note_index, bank };
-                                mix += WAVE_WAVEFORMS[bank](&wave, note, 0.0f);
-                            }
-                        }
-                    }
-                }
-                mix *= CONST_NOTE_AMPLIFICATION;
-                for(uint32_t speaker = 0; speaker < consumer->audio->spec.channels; speaker++)
-                    mixes[sample + speaker] = mix;
-            }
-            SDL_LockAudioDevice(consumer->audio->dev);
-            SDL_QueueAudio(consumer->audio->dev, mixes, mixes_size);
-            SDL_UnlockAudioDevice(consumer->audio->dev);
-            free(mixes);
+            // The master is always written. Channels that are never heard get no file.
+            uint32_t frame = 0;
+            while(frame < stems->fill && part[frame] == 0)
+                frame++;
+            if(frame == stems->fill && i < CONST_CHANNEL_MAX)
+                continue;
+            Stem_Open(stem, stems);
         }
-        SDL_Delay(1);
+        Audio_Limit(part, stems->frames, stems->fill, stems->channels, stems->engine);
+        Stem_Write(stem, stems->frames, stems->fill * stems->channels);
     }
-    return 0;
+    stems->written += stems->fill;
+    stems->fill = 0;
 }
 
-static Midi
-Midi_Init(Bytes* bytes)
+static void
+Stems_Free(Stems* stems)
 {
-    Midi midi = { 0 };
-    midi.id = Bytes_U32(bytes, 0);
-    midi.size = Bytes_U32(bytes, 4);
-    midi.format_type = Bytes_U16(bytes, 8);
-    midi.track_count = Bytes_U16(bytes, 10);
-    midi.time_division = Bytes_U16(bytes, 12);
-    midi.track = calloc(midi.track_count, sizeof(*midi.track));
-    uint32_t offset = 14;
-    for(uint32_t number = 0; number < midi.track_count; number++)
-    {
-        if(number > 0)
+    Stems_Flush(stems);
+    for(uint32_t i = 0; i <= CONST_CHANNEL_MAX; i++)
+    {
+        Stem* stem = &stems->stem[i];
+        if(stem->file == NULL)
+            continue;
+        fseek(stem->file, 0, SEEK_SET);
+        Wav_Header(stem->file, stems->channels, stems->written * stems->channels * sizeof(*stems->frames));
+        fclose(stem->file);
+    }
+    free(stems->parts);
+    free(stems->frames);
+}
+
+static uint64_t
+Midi_RenderStems(FILE* file, bool stream, Engine engine, char* dir)
+{
+    // Every channel and the master come out of one synthesis pass, flushed in large blocks.
+    Notes* notes = calloc(1, sizeof(*notes));
+    Notes* modus = calloc(1, sizeof(*modus));
+    Meta meta = { 0 };
+    Notes_Setup(modus);
+    Bytes bytes = { 0 };
+    if(!stream)
+        bytes = Bytes_FromFile(file);
+    Midi midi = stream ? Midi_Stream(file) : Midi_Init(&bytes);
+    Synth synth = Synth_Init(engine);
+    Stems stems = Stems_Init(dir, 2, engine);
+    jmp_buf crash;
+    if(stream)
+    {
+        Midi_Target(&midi, &crash);
+        if(setjmp(crash))
+            Midi_Changed();
+    }
+    Render render = { &midi, notes, modus, &meta, 2, &synth, 0, 0, 0, false };
+    while(!render.done)
+    {
+        if(render.frame == render.target)
         {
-            offset += 8;
-            offset += midi.track[number - 1].size;
+            Midi_Step(render.midi, render.notes, render.meta);
+            render.done = Midi_Done(render.midi);
+            render.target = Tempos_Sample(&render.midi->tempos, render.midi->tick);
+            continue;
         }
-        midi.track[number] = Track_Init(bytes, offset, number);
+        uint64_t count = render.target - render.frame;
+        if(count > CONST_STEM_FRAMES - stems.fill)
+            count = CONST_STEM_FRAMES - stems.fill;
+        render.voices += Audio_Voices(notes, modus, &meta, &stems.parts[stems.fill], CONST_STEM_FRAMES, STEM_ROUTE, CONST_CHANNEL_MAX, count, &synth);
+        render.frame += count;
+        stems.fill += count;
+        if(stems.fill == CONST_STEM_FRAMES)
+            Stems_Flush(&stems);
     }
-    return midi;
+    Stems_Free(&stems);
+    Midi_Free(&midi);
+    Bytes_Free(&bytes);
+    free(notes);
+    free(modus);
+    return render.voices;
+}
+
+static bool
+Daemon_Read(int fd, uint8_t* data, uint32_t size, uint64_t deadline)
+{
+    // Stalled clients are dropped at the deadline, so they cannot hold a worker forever.
+    uint32_t done = 0;
+    while(done < size)
+    {
+        uint64_t now = SDL_GetPerformanceCounter();
+        if(now >= deadline)
+            return false;
+        struct pollfd ready = { fd, POLLIN, 0 };
+        int wait = (deadline - now) * 1000 / SDL_GetPerformanceFrequency() + 1;
+        if(poll(&ready, 1, wait) != 1)
+            return false;
+        ssize_t got = read(fd, &data[done], size - done);
+        if(got <= 0)
+            return false;
+        done += got;
+    }
+    return true;
 }
 
 static void
-Midi_Free(Midi* midi)
+Daemon_Push(Daemon* daemon, int client)
 {
-    for(uint32_t number = 0; number < midi->track_count; number++)
-        Track_Free(&midi->track[number]);
-    free(midi->track);
-    midi->track = NULL;
+    SDL_LockMutex(daemon->mutex);
+    while(daemon->count == CONST_DAEMON_BACKLOG)
+        SDL_CondWait(daemon->space, daemon->mutex);
+    daemon->client[(daemon->head + daemon->count++) % CONST_DAEMON_BACKLOG] = client;
+    SDL_CondSignal(daemon->ready);
+    SDL_UnlockMutex(daemon->mutex);
 }
 
-static bool
-Midi_Done(Midi* midi)
+static int
+Daemon_Pop(Daemon* daemon)
 {
-    uint32_t count = 0;
-    for(uint32_t i = 0; i < midi->track_count; i++)
-        if(midi->track[i].run)
-            count += 1;
-    return count == 0;
+    SDL_LockMutex(daemon->mutex);
+    while(daemon->count == 0)
+        SDL_CondWait(daemon->ready, daemon->mutex);
+    int client = daemon->client[daemon->head];
+    daemon->head = (daemon->head + 1) % CONST_DAEMON_BACKLOG;
+    daemon->count -= 1;
+    SDL_CondSignal(daemon->space);
+    SDL_UnlockMutex(daemon->mutex);
+    return client;
 }
 
-static uint32_t
-Midi_ShaveTicks(Midi* midi)
+static bool
+Worker_Request(Worker* worker, int client, uint32_t* channels, uint32_t* seconds)
 {
-    uint32_t ticks = UINT32_MAX;
-    for(uint32_t i = 0; i < midi->track_count; i++)
+    // Request: "<smf bytes> <channels: 1, 2> <max seconds, 0 for all>\n" then the SMF.
+    uint64_t deadline = SDL_GetPerformanceCounter() + CONST_DAEMON_TIMEOUT * SDL_GetPerformanceFrequency();
+    char line[64] = { 0 };
+    for(uint32_t i = 0; i < sizeof(line) - 1; i++)
     {
-        Track* track = &midi->track[i];
-        if(track->run)
-            if(track->delay < ticks)
-                ticks = track->delay;
+        if(!Daemon_Read(client, (uint8_t*) &line[i], 1, deadline))
+            return false;
+        if(line[i] == '\n')
+            break;
     }
-    for(uint32_t i = 0; i < midi->track_count; i++)
+    uint32_t size;
+    if(sscanf(line, "%u %u %u", &size, channels, seconds) != 3)
+        return false;
+    if(size > CONST_DAEMON_SIZE_MAX || (*channels != 1 && *channels != 2))
+        return false;
+    if(size > worker->capacity)
     {
-        Track* track = &midi->track[i];
-        if(track->run)
-            track->delay -= ticks - 1;
+        worker->request.data = realloc(worker->request.data, size);
+        worker->capacity = size;
     }
-    return ticks;
+    worker->request.size = size;
+    return Daemon_Read(client, worker->request.data, size, deadline);
 }
 
-static uint32_t
-Midi_ToMicrosecondDelay(Midi* midi, Meta* meta)
+static void
+Worker_Serve(Worker* worker, int client)
 {
-    bool use_ticks = (midi->time_division & 0x8000) == 0;
-    if(use_ticks)
+    FILE* out = fdopen(client, "wb");
+    setvbuf(out, worker->buffer, _IOFBF, CONST_DAEMON_BUFFER);
+    uint32_t channels;
+    uint32_t seconds;
+    if(!Worker_Request(worker, client, &channels, &seconds) || !Midi_Check(&worker->request))
+    {
+        fputs("ERR request\n", out);
+        fclose(out);
+        return;
+    }
+    Meta meta = { 0 };
+    // A bad file longjmps back here with the midi still reachable, so nothing leaks.
+    worker->midi = Midi_Header(&worker->request);
+    if(setjmp(worker->crash) == 0)
     {
-        uint32_t ticks = Midi_ShaveTicks(midi);
-        uint32_t microseconds = ticks * meta->tempo / midi->time_division;
-        return microseconds;
+        Midi_Load(&worker->midi, &worker->request, worker->notes, &worker->crash);
+        // Warm state is reset, never reallocated.
+        memset(worker->notes, 0, sizeof(*worker->notes));
+        memset(worker->modus, 0, sizeof(*worker->modus));
+        Notes_Setup(worker->modus);
+        uint64_t frames = Tempos_Sample(&worker->midi.tempos, worker->midi.ticks);
+        if(seconds > 0 && frames > (uint64_t) seconds * CONST_SAMPLE_FREQ)
+            frames = (uint64_t) seconds * CONST_SAMPLE_FREQ;
+        fprintf(out, "OK %lu %u\n", (unsigned long) frames, channels);
+        Midi_Render(&worker->midi, worker->notes, worker->modus, &meta, out, frames, channels, &worker->daemon->synth);
     }
-    // Frames Per Second.
     else
+        fputs("ERR midi\n", out);
+    Midi_Free(&worker->midi);
+    fclose(out);
+}
+
+static int
+Worker_Run(void* data)
+{
+    Worker* worker = data;
+    Realtime_Worker(worker->daemon->rt, worker->number, "daemon worker");
+    while(true)
+        Worker_Serve(worker, Daemon_Pop(worker->daemon));
+    return 0;
+}
+
+static void
+Daemon_Run(char* path, int workers, Engine engine, Realtime* rt)
+{
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    if(server == -1
+    || bind(server, (struct sockaddr*) &address, sizeof(address)) == -1
+    || listen(server, CONST_DAEMON_BACKLOG) == -1)
     {
-        fprintf(stderr, "FRAMES PER SECOND DELAYS ARE CURRENTLY NOT SUPPORTED\n");
-        exit(1);
+        fprintf(stderr, "daemon: cannot listen on %s\n", path);
+        exit(ERROR_FILE);
+    }
+    // Clients hanging up mid stream must not take the daemon down.
+    signal(SIGPIPE, SIG_IGN);
+    Daemon daemon = { 0 };
+    daemon.synth = Synth_Init(engine);
+    daemon.rt = rt;
+    daemon.mutex = SDL_CreateMutex();
+    daemon.ready = SDL_CreateCond();
+    daemon.space = SDL_CreateCond();
+    Worker* worker = calloc(workers, sizeof(*worker));
+    for(int i = 0; i < workers; i++)
+    {
+        worker[i].daemon = &daemon;
+        worker[i].number = i;
+        worker[i].notes = calloc(1, sizeof(*worker[i].notes));
+        worker[i].modus = calloc(1, sizeof(*worker[i].modus));
+        worker[i].buffer = malloc(CONST_DAEMON_BUFFER);
+        worker[i].thread = SDL_CreateThread(Worker_Run, "MIDI-DAEMON-WORKER", &worker[i]);
+    }
+    Realtime_Lock(rt);
+    fprintf(stderr, "daemon: listening on %s with %d workers\n", path, workers);
+    while(true)
+    {
+        int client = accept(server, NULL, NULL);
+        if(client == -1)
+            continue;
+        // A client that stops reading fails the worker's writes instead of blocking them.
+        struct timeval timeout = { CONST_DAEMON_TIMEOUT, 0 };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        Daemon_Push(&daemon, client);
+    }
+}
+
+// The first path is hashed. Only the integer engine renders the same bits under every compiler and
+// CFLAGS, so float paths are checked against each other on the running build instead.
+static Path GOLDEN_PATHS[] = {
+    { "fixed", false, ENGINE_FIXED, 1, 0, 0.0 },
+    { "float", false, ENGINE_FLOAT, 1, 0, 6.0 },
+    { "stream", true, ENGINE_FLOAT, 1, 1, 0.0 },
+    { "parallel", false, ENGINE_FLOAT, 4, 1, 0.0 },
+    { "polyblep", false, ENGINE_POLYBLEP, 1, 1, 20.0 },
+};
+
+static Bytes
+Golden_Render(char* name, Path* path, double* seconds)
+{
+    FILE* file = fopen(name, "rb");
+    if(file == NULL)
+    {
+        fprintf(stderr, "golden: cannot open %s\n", name);
+        exit(ERROR_FILE);
     }
+    FILE* out = tmpfile();
+    uint64_t start = SDL_GetPerformanceCounter();
+    Midi_RenderFile(file, path->stream, path->engine, path->threads, out, NULL);
+    *seconds = Bench_Seconds(start);
+    Bytes pcm = Bytes_FromFile(out);
+    fclose(out);
+    fclose(file);
+    return pcm;
 }
 
 static void
-Midi_Play(Midi* midi, Notes* notes, Meta* meta)
+Golden_Compare(Bytes* reference, Bytes* pcm, int* max_abs_diff, double* snr_db)
+{
+    // Samples missing from the shorter render count as silence.
+    uint32_t size = reference->size > pcm->size ? reference->size : pcm->size;
+    double signal = 0.0;
+    double noise = 0.0;
+    *max_abs_diff = 0;
+    for(uint32_t i = 0; i + 1 < size; i += sizeof(int16_t))
+    {
+        int16_t a = 0;
+        int16_t b = 0;
+        if(i + 1 < reference->size)
+            memcpy(&a, &reference->data[i], sizeof(a));
+        if(i + 1 < pcm->size)
+            memcpy(&b, &pcm->data[i], sizeof(b));
+        int diff = abs(a - b);
+        if(diff > *max_abs_diff)
+            *max_abs_diff = diff;
+        signal += (double) a * a;
+        noise += (double) diff * diff;
+    }
+    *snr_db = noise == 0.0 ? 0.0 : 10.0 * log10(signal / noise);
+}
+
+static bool
+Golden_Reject(char* name, char* reply, uint32_t size)
 {
-    while(!DONE)
+    // The file goes to a forked daemon worker over a socket pair, just as a client would send it.
+    FILE* file = fopen(name, "rb");
+    int fds[2];
+    if(file == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
     {
-        for(uint32_t i = 0; i < midi->track_count; i++)
-            Track_Play(&midi->track[i], notes, meta);
-        uint32_t microseconds = Midi_ToMicrosecondDelay(midi, meta);
-        uint32_t milliseconds = roundf(microseconds / 1000.0f);
-        if(Midi_Done(midi))
-            DONE = true;
-        else
-            SDL_Delay(milliseconds);
+        fprintf(stderr, "golden: cannot open %s\n", name);
+        exit(ERROR_FILE);
+    }
+    Bytes bytes = Bytes_FromFile(file);
+    fclose(file);
+    if(fork() == 0)
+    {
+        close(fds[0]);
+        Daemon daemon = { 0 };
+        daemon.synth = Synth_Init(ENGINE_FLOAT);
+        Worker worker = { 0 };
+        worker.daemon = &daemon;
+        worker.notes = calloc(1, sizeof(*worker.notes));
+        worker.modus = calloc(1, sizeof(*worker.modus));
+        worker.buffer = malloc(CONST_DAEMON_BUFFER);
+        Worker_Serve(&worker, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    // A file that is wrongly accepted renders at most a second, which is read to the end.
+    FILE* client = fdopen(fds[0], "r+b");
+    fprintf(client, "%u 1 1\n", bytes.size);
+    fwrite(bytes.data, sizeof(*bytes.data), bytes.size, client);
+    fflush(client);
+    if(fgets(reply, size, client) == NULL)
+        reply[0] = '\0';
+    reply[strcspn(reply, "\n")] = '\0';
+    while(fgetc(client) != EOF)
+        continue;
+    fclose(client);
+    wait(NULL);
+    Bytes_Free(&bytes);
+    return strncmp(reply, "ERR ", 4) == 0;
+}
+
+static bool
+Golden_Run(char* hashes, bool update)
+{
+    FILE* file = fopen(hashes, "r");
+    if(file == NULL)
+    {
+        fprintf(stderr, "golden: cannot open %s\n", hashes);
+        exit(ERROR_FILE);
+    }
+    uint32_t paths = sizeof(GOLDEN_PATHS) / sizeof(*GOLDEN_PATHS);
+    char lines[64][256];
+    uint32_t count = 0;
+    bool pass = true;
+    char expected[32];
+    char name[192];
+    while(count < 64 && fscanf(file, "%31s %191s", expected, name) == 2)
+    {
+        // Malformed files are listed as errors, and the daemon must answer them with one.
+        if(strcmp(expected, "error") == 0)
+        {
+            char reply[64];
+            bool rejected = Golden_Reject(name, reply, sizeof(reply));
+            pass &= rejected;
+            printf("{\"file\": ");
+            Json_Print(name);
+            printf(", \"path\": \"daemon\", \"reply\": ");
+            Json_Print(reply);
+            printf(", \"match\": %s}\n", rejected ? "true" : "false");
+            snprintf(lines[count++], sizeof(*lines), "error %s\n", name);
+            continue;
+        }
+        unsigned long long expect = strtoull(expected, NULL, 16);
+        double seconds = 0.0;
+        Bytes pcm[sizeof(GOLDEN_PATHS) / sizeof(*GOLDEN_PATHS)];
+        pcm[0] = Golden_Render(name, &GOLDEN_PATHS[0], &seconds);
+        uint64_t hash = Bytes_Hash(&pcm[0]);
+        double duration = pcm[0].size / (2.0 * sizeof(int16_t) * CONST_SAMPLE_FREQ);
+        bool match = hash == expect;
+        pass &= match || update;
+        printf("{\"file\": ");
+        Json_Print(name);
+        printf(", \"path\": \"%s\", \"hash\": \"%016llx\", \"expect\": \"%016llx\", \"match\": %s, "
+               "\"render_seconds\": %.4f, \"realtime_factor\": %.1f}\n",
+            GOLDEN_PATHS[0].name, (unsigned long long) hash, expect, match ? "true" : "false",
+            seconds, duration / seconds);
+        snprintf(lines[count++], sizeof(*lines), "%016llx %s\n", (unsigned long long) hash, name);
+        for(uint32_t i = 1; i < paths; i++)
+        {
+            Path* path = &GOLDEN_PATHS[i];
+            pcm[i] = Golden_Render(name, path, &seconds);
+            int max_abs_diff;
+            double snr_db;
+            Golden_Compare(&pcm[path->against], &pcm[i], &max_abs_diff, &snr_db);
+            char snr[32] = "null"; // Identical renders.
+            if(max_abs_diff > 0)
+                snprintf(snr, sizeof(snr), "%.2f", snr_db);
+            bool close = max_abs_diff == 0 || (path->snr_min > 0.0 && snr_db >= path->snr_min);
+            pass &= close;
+            printf("{\"file\": ");
+            Json_Print(name);
+            printf(", \"path\": \"%s\", \"against\": \"%s\", \"max_abs_diff\": %d, \"snr_db\": %s, \"snr_min\": %.1f, \"match\": %s, "
+                   "\"render_seconds\": %.4f, \"realtime_factor\": %.1f}\n",
+                path->name, GOLDEN_PATHS[path->against].name, max_abs_diff, snr, path->snr_min, close ? "true" : "false",
+                seconds, duration / seconds);
+        }
+        for(uint32_t i = 0; i < paths; i++)
+            Bytes_Free(&pcm[i]);
     }
+    fclose(file);
+    if(update)
+    {
+        file = fopen(hashes, "w");
+        for(uint32_t i = 0; i < count; i++)
+            fputs(lines[i], file);
+        fclose(file);
+    }
+    return pass;
+}
+
+// One row of CONST_FONT_W bits per line, most significant bit on the left, in CONST_FONT_CHARS order.
+static const uint8_t FONT_GLYPHS[][CONST_FONT_H] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ' '
+    { 0x00, 0x1C, 0x22, 0x26, 0x2A, 0x32, 0x22, 0x1C, 0x00 }, // '0'
+    { 0x00, 0x08, 0x18, 0x28, 0x08, 0x08, 0x08, 0x3E, 0x00 }, // '1'
+    { 0x00, 0x1C, 0x22, 0x02, 0x04, 0x08, 0x10, 0x3E, 0x00 }, // '2'
+    { 0x00, 0x1C, 0x22, 0x02, 0x0C, 0x02, 0x22, 0x1C, 0x00 }, // '3'
+    { 0x00, 0x0C, 0x14, 0x24, 0x3E, 0x04, 0x04, 0x04, 0x00 }, // '4'
+    { 0x00, 0x3E, 0x20, 0x20, 0x3C, 0x02, 0x02, 0x3C, 0x00 }, // '5'
+    { 0x00, 0x1C, 0x20, 0x20, 0x3C, 0x22, 0x22, 0x1C, 0x00 }, // '6'
+    { 0x00, 0x3E, 0x02, 0x04, 0x08, 0x10, 0x10, 0x10, 0x00 }, // '7'
+    { 0x00, 0x1C, 0x22, 0x22, 0x1C, 0x22, 0x22, 0x1C, 0x00 }, // '8'
+    { 0x00, 0x1C, 0x22, 0x22, 0x1E, 0x02, 0x02, 0x1C, 0x00 }, // '9'
+    { 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00 }, // ':'
+};
+
+static SDL_Surface*
+Video_Font(void)
+{
+    // Glyphs are laid out in one row, so the glyph index is its column.
+    int count = sizeof(FONT_GLYPHS) / sizeof(*FONT_GLYPHS);
+    SDL_Surface* font = SDL_CreateRGBSurfaceWithFormat(0, count * CONST_FONT_W, CONST_FONT_H, 32, SDL_PIXELFORMAT_ARGB8888);
+    uint32_t white = SDL_MapRGB(font->format, 0xFF, 0xFF, 0xFF);
+    uint32_t black = SDL_MapRGB(font->format, 0x0, 0x0, 0x0);
+    for(int glyph = 0; glyph < count; glyph++)
+        for(int y = 0; y < CONST_FONT_H; y++)
+        {
+            uint32_t* row = (uint32_t*) ((uint8_t*) font->pixels + y * font->pitch);
+            for(int x = 0; x < CONST_FONT_W; x++)
+                row[glyph * CONST_FONT_W + x] = FONT_GLYPHS[glyph][y] >> (CONST_FONT_W - 1 - x) & 1 ? white : black;
+        }
+    return font;
 }
 
 static Video
@@ -1027,7 +2868,7 @@ Video_Init(void)
 {
     Video video;
     SDL_CreateWindowAndRenderer(CONST_XRES, CONST_YRES, 0, &video.window, &video.renderer);
-    SDL_Surface* font = SDL_LoadBMP("font.bmp");
+    SDL_Surface* font = Video_Font();
     SDL_SetColorKey(font, SDL_TRUE, SDL_MapRGB(font->format, 0x0, 0x0, 0x0));
     video.font = SDL_CreateTextureFromSurface(video.renderer, font);
     SDL_FreeSurface(font);
@@ -1045,28 +2886,13 @@ Video_Free(Video* video)
 static void
 Video_Putc(Video* video, int x, int y, char c)
 {
-    SDL_Rect s = { 0, 0, CONST_FONT_W, CONST_FONT_H };
-    switch(c)
-    {
-        case ' ': s.x =  0; s.y = 0; break;
-        case '0': s.x = 16; s.y = 0; break;
-        case '1': s.x = 17; s.y = 0; break;
-        case '2': s.x =  0; s.y = 1; break;
-        case '3': s.x =  1; s.y = 1; break;
-        case '4': s.x =  2; s.y = 1; break;
-        case '5': s.x =  3; s.y = 1; break;
-        case '6': s.x =  4; s.y = 1; break;
-        case '7': s.x =  5; s.y = 1; break;
-        case '8': s.x =  6; s.y = 1; break;
-        case '9': s.x =  7; s.y = 1; break;
-        case ':': s.x =  8; s.y = 1; break;
-        default:
-            printf("Video_Putc character '%c' not supported\n", c);
-            exit(1);
-            break;
+    char* glyph = c == '\0' ? NULL : strchr(CONST_FONT_CHARS, c);
+    if(glyph == NULL)
+    {
+        printf("Video_Putc character '%c' not supported\n", c);
+        exit(1);
     }
-    s.x *= s.w;
-    s.y *= s.h;
+    SDL_Rect s = { (glyph - CONST_FONT_CHARS) * CONST_FONT_W, 0, CONST_FONT_W, CONST_FONT_H };
     SDL_Rect d = { x, y, CONST_FONT_RENDER_W, CONST_FONT_RENDER_H };
     SDL_RenderCopy(video->renderer, video->font, &s, &d);
 }
@@ -1080,7 +2906,7 @@ Video_Puts(Video* video, int x, int y, char* s)
 }
 
 static void
-Buffer(SDL_Point points[], Meta* meta, Notes* notes, Notes* modus, int channel)
+Buffer(SDL_Point points[], Meta* meta, Notes* notes, Notes* modus, Synth* synth, int channel)
 {
     float buffer[CONST_VIDEO_SAMPLES] = { 0 };
     int bank = Meta_GetBank(meta, channel);
@@ -1091,7 +2917,7 @@ Buffer(SDL_Point points[], Meta* meta, Notes* notes, Notes* modus, int channel)
         if(note.on)
         {
             note.progress = modu.progress = 0;
-            Wave wave = { &modu, meta, channel, note_index, bank };
+            Wave wave = { &modu, meta, channel, note_index, bank, synth };
             for(int i = 0; i < CONST_VIDEO_SAMPLES; i++)
                 buffer[i] += WAVE_WAVEFORMS[bank](&wave, &note, 0.0f);
         }
@@ -1139,62 +2965,127 @@ Video_DrawChannel(Video* video, Meta* meta, SDL_Point points[], int channel)
 }
 
 static void
-Video_Draw(Video* video, Meta* meta, Notes* notes, Notes* modus)
+Video_Draw(Video* video, Meta* meta, Notes* notes, Notes* modus, Synth* synth)
 {
     Video_Clear(video);
     for(int channel = 0; channel < CONST_CHANNEL_MAX; channel++)
     {
         SDL_Point points[CONST_VIDEO_POINT_COUNT];
-        Buffer(points, meta, notes, modus, channel);
+        Buffer(points, meta, notes, modus, synth, channel);
         Video_DrawChannel(video, meta, points, channel);
     }
     SDL_RenderPresent(video->renderer);
 }
 
-static int
-Video_Play(void* data)
+static void
+Video_Play(Consumer* consumer)
 {
-    Consumer* consumer = data;
+    // Runs on the main thread once audio is playing, so the window never delays the first sample.
+    SDL_InitSubSystem(SDL_INIT_VIDEO);
+    Video video = Video_Init();
+    Startup_Report("video ready", consumer->boot);
     for(int32_t cycles = 0; !DONE; cycles++)
     {
         SDL_Event e;
         SDL_PollEvent(&e);
         if(e.type == SDL_QUIT)
             DONE = true;
-        Video_Draw(consumer->video, consumer->meta, consumer->notes, consumer->modus);
+        TRACE_BEGIN(frame);
+        Video_Draw(&video, consumer->meta, consumer->notes, consumer->modus, consumer->synth);
+        TRACE_END(TRACE_VIDEO, frame);
         SDL_Delay(10);
     }
-    return 0;
+    Video_Free(&video);
 }
 
 int
 main(int argc, char** argv)
 {
-    SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO);
+    uint64_t boot = SDL_GetPerformanceCounter();
     Args args = Args_Init(argc, argv);
-    Video video = Video_Init();
-    Audio audio = Audio_Init();
-    Bytes bytes = Bytes_FromFile(args.file);
+    if(args.bench)
+    {
+        Bench_Run(&args);
+        Args_Free(&args);
+        exit(ERROR_NONE);
+    }
+    if(args.daemon)
+        Daemon_Run(args.daemon, args.workers, args.engine, &args.rt);
+    if(args.golden)
+        exit(Golden_Run(args.golden, args.golden_update) ? ERROR_NONE : ERROR_GOLDEN);
+    if(args.analyze)
+    {
+        bool ok = Analyze_Run(&args);
+        Args_Free(&args);
+        exit(ok ? ERROR_NONE : ERROR_FILE);
+    }
+    if(args.render)
+    {
+        FILE* out = fopen(args.render, "wb");
+        if(out == NULL)
+            exit(ERROR_FILE);
+        Midi_RenderFile(args.file, args.stream, args.engine, args.threads, out, &args.rt);
+        fclose(out);
+        Args_Free(&args);
+        exit(ERROR_NONE);
+    }
+    if(args.stems)
+    {
+        Midi_RenderStems(args.file, args.stream, args.engine, args.stems);
+        Args_Free(&args);
+        exit(ERROR_NONE);
+    }
+    SDL_Init(SDL_INIT_AUDIO);
+    Audio audio = Audio_Init(args.live ? CONST_LIVE_SAMPLES : CONST_AUDIO_SAMPLES);
     Notes notes = { 0 };
     Notes modus = { 0 };
     Meta meta = { 0 };
     Notes_Setup(&modus);
-    // Consume...
-    Consumer consumer = { &audio, &notes, &modus, &meta, &video };
-    SDL_Thread* audio_thread = SDL_CreateThread(Audio_Play, "MIDI-AUDIO-CONSUMER", &consumer);
-    SDL_Thread* video_thread = SDL_CreateThread(Video_Play, "MIDI-VIDEO-CONSUMER", &consumer);
-    // .. And produce.
-    do
+    Synth synth = Synth_Init(args.engine);
+    Live live = { 0 };
+    if(args.live)
     {
-        Midi midi = Midi_Init(&bytes);
-        Midi_Play(&midi, &notes, &meta);
-        Midi_Free(&midi);
+        live = Live_Init(args.live);
+        for(int channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+            meta.volume[channel] = CONST_VOLUME_DEFAULT;
     }
-    while(args.loop);
+    Song song = { 0 };
+    Cache cache = { 0 };
+    if(args.file)
+    {
+        song = Song_Init(args.path, args.stream, args.compiled);
+        TRACE_BEGIN(parse);
+        Song_Load(&song);
+        TRACE_END(TRACE_MIDI, parse);
+        // Playback is deterministic, so looping replays the first pass instead of synthesizing it again.
+        // Playlists, and songs the cache cannot hold, loop by playing again.
+        if(args.loop && args.song_count == 1 && song.ok && !args.watch)
+        {
+            cache = Cache_Init(Tempos_Sample(&song.midi.tempos, song.midi.ticks), audio.spec.channels);
+            if(cache.size > 0)
+                Cache_Start(&cache, Song_Init(args.path, args.stream, args.compiled), args.engine, &args.rt);
+        }
+    }
+    // Consume...
+    Sinks sinks = Sinks_Init(&audio);
+    if(args.wav)
+        Sinks_Add(&sinks, args.wav, true);
+    if(args.pipe)
+        Sinks_Add(&sinks, args.pipe, false);
+    Consumer consumer = { &audio, &notes, &modus, &meta, args.live ? &live : NULL, cache.size > 0 ? &cache : NULL, &synth, &args.rt, &sinks, boot };
+    Realtime_Lock(&args.rt);
+    SDL_Thread* audio_thread = SDL_CreateThread(Audio_Play, "MIDI-AUDIO-CONSUMER", &consumer);
+    // .. And produce. Video then takes the main thread until quit.
+    Producer producer = { &args, &song, &notes, &meta, &cache };
+    SDL_Thread* producer_thread = SDL_CreateThread(Producer_Run, "MIDI-PRODUCER", &producer);
+    Video_Play(&consumer);
+    SDL_WaitThread(producer_thread, NULL);
     SDL_WaitThread(audio_thread, NULL);
-    SDL_WaitThread(video_thread, NULL);
-    Video_Free(&video);
-    Bytes_Free(&bytes);
+    Sinks_Free(&sinks);
+    TRACE_DUMP();
+    if(args.live)
+        Live_Free(&live);
+    Cache_Free(&cache);
     Args_Free(&args);
     Audio_Free(&audio);
     SDL_Quit();
@@ -0,0 +1,1808 @@
+#include <math.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "minimidi.h"
+
+#define CONST_PI (3.14159265358979323846f)
+#define CONST_NOTE_ATTACK (4)
+#define CONST_NOTE_AMPLIFICATION (15)
+#define CONST_NOTES_MAX (128)
+#define CONST_CHANNEL_MAX (16)
+#define CONST_NOTE_DECAY (512)
+#define CONST_BEND_DEFAULT (8192)
+#define CONST_SAMPLE_FREQ (44100)
+#define CONST_MODULATION_GAIN (512)
+#define CONST_BANK_WIDTH (8)
+#define CONST_TRACK_WINDOW (512)
+#define CONST_RENDER_SAMPLES (4096)
+#define CONST_TEMPO_DEFAULT (500000)
+#define CONST_FIXED_SINE_BITS (12)
+#define CONST_FIXED_PITCH_BITS (12)
+#define CONST_FIXED_PITCH_LOW (24)
+#define CONST_QUALITY_VOICES (24)
+#define CONST_BUS_FRAMES (1024)
+#define CONST_LIMIT_KNEE (24576)
+#define CONST_LIMIT_CEILING (32767)
+
+typedef enum
+{
+    ENGINE_FLOAT = MINIMIDI_ENGINE_FLOAT,
+    ENGINE_FIXED = MINIMIDI_ENGINE_FIXED,
+    ENGINE_POLYBLEP = MINIMIDI_ENGINE_POLYBLEP,
+}
+Engine;
+
+// Tables are per synth rather than global, so contexts never share writable state.
+typedef struct
+{
+    int16_t sine[1 << CONST_FIXED_SINE_BITS];
+    uint32_t semitone[12];
+    uint32_t fine[1 << CONST_FIXED_PITCH_BITS];
+}
+Fixed;
+
+// Stages a player steps down through when it cannot keep up, cheapest last.
+typedef enum
+{
+    QUALITY_FULL,
+    QUALITY_NO_FM, // Modulators are not evaluated.
+    QUALITY_CHEAP, // Polynomial sine and triangle, no band limiting.
+    QUALITY_CAPPED, // At most CONST_QUALITY_VOICES voices per sample.
+    QUALITY_STAGES,
+}
+Quality;
+
+typedef struct
+{
+    Engine engine;
+    Quality quality;
+    Fixed fixed;
+}
+Synth;
+
+typedef struct
+{
+    uint32_t tempo;
+    int instruments[CONST_CHANNEL_MAX];
+    int bend[CONST_CHANNEL_MAX];
+    int volume[CONST_CHANNEL_MAX];
+}
+Meta;
+
+typedef struct
+{
+    uint8_t* data;
+    uint32_t size;
+}
+Bytes;
+
+typedef struct
+{
+    int gain;
+    int gain_setpoint;
+    int progress;
+    int bend_last;
+    float id;
+    int pitch;
+    uint32_t phase;
+    uint32_t phase_step;
+    bool on;
+    bool wait;
+    bool was_init;
+}
+Note;
+
+typedef struct
+{
+    Note note[CONST_CHANNEL_MAX][CONST_NOTES_MAX];
+}
+Notes;
+
+typedef struct
+{
+    Note* modu;
+    Meta* meta;
+    uint8_t channel;
+    int id;
+    int bank;
+    Synth* synth;
+}
+Wave;
+
+typedef int16_t Signal(Wave*, Note*, float fm);
+
+typedef int16_t FixedSignal(Wave*, Note*, uint32_t fm);
+
+typedef struct
+{
+    FixedSignal* carrier;
+    FixedSignal* modulator;
+    int volume;
+}
+Instrument;
+
+typedef struct
+{
+    uint8_t leader;
+    uint8_t a;
+    uint8_t b;
+}
+Message;
+
+// A channel message at its tick, laid out to be stored and mapped as is.
+typedef struct
+{
+    uint64_t tick;
+    uint8_t leader;
+    uint8_t a;
+    uint8_t b;
+    uint8_t reserved[5];
+}
+Event;
+
+typedef struct
+{
+    Event* event;
+    uint32_t count;
+    uint32_t max;
+}
+Events;
+
+typedef struct
+{
+    uint8_t* data;
+    FILE* file;
+    jmp_buf* crash;
+    Events* record;
+    uint32_t id;
+    uint32_t size;
+    uint32_t index;
+    uint32_t offset;
+    uint32_t start;
+    uint32_t count;
+    uint32_t number;
+    uint32_t events;
+    uint64_t tick;
+    uint8_t running_status;
+    bool run;
+    bool crashed;
+}
+Track;
+
+typedef struct
+{
+    uint64_t tick;
+    uint64_t time;
+    uint32_t rate;
+    uint32_t reserved; // Spelled out and zeroed, so compiled song files never carry padding bytes.
+}
+Tempo;
+
+typedef struct
+{
+    Tempo* tempo;
+    uint32_t count;
+    uint64_t scale;
+}
+Tempos;
+
+// Either tracks decoded as they play, or a precompiled event array replayed in order.
+typedef struct
+{
+    Track* track;
+    Tempos tempos;
+    uint32_t* heap;
+    uint32_t heap_count;
+    Event* events;
+    uint32_t event_count;
+    uint32_t event_index;
+    uint64_t tick;
+    uint64_t ticks;
+    uint32_t id;
+    uint32_t size;
+    uint16_t format_type;
+    uint16_t track_count;
+    uint16_t time_division;
+}
+Midi;
+
+typedef struct
+{
+    Midi* midi;
+    Notes* notes;
+    Notes* modus;
+    Meta* meta;
+    uint32_t channels;
+    Synth* synth;
+    uint64_t frame;
+    uint64_t target;
+    uint64_t voices;
+    bool done;
+}
+Render;
+
+static int
+Meta_GetBank(Meta* meta, int channel)
+{
+    return meta->instruments[channel] / CONST_BANK_WIDTH;
+}
+
+static uint8_t
+Bytes_U8(Bytes* bytes, uint32_t index)
+{
+    return bytes->data[index];
+}
+
+static uint16_t
+Bytes_U16(Bytes* bytes, uint32_t index)
+{
+    return Bytes_U8(bytes, index + 0) << 8
+         | Bytes_U8(bytes, index + 1);
+}
+
+static uint32_t
+Bytes_U32(Bytes* bytes, uint32_t index)
+{
+    return Bytes_U16(bytes, index + 0) << 16
+         | Bytes_U16(bytes, index + 2);
+}
+
+static void
+Note_Clamp(Note* note)
+{
+    int min = 0;
+    int max = CONST_NOTE_ATTACK * 127;
+    if(note->gain < min) note->gain = min;
+    if(note->gain > max) note->gain = max;
+}
+
+static void
+Note_Roll(Note* note) // Attack and Decay/Sustain.
+{
+    int diff = note->gain_setpoint - note->gain;
+    if(diff == 0)
+    {
+        if(note->gain == 0)
+        {
+            note->was_init = false;
+            note->on = false;
+        }
+        // Note decays when held.
+        else
+        {
+            if(note->progress != 0)
+            {
+                bool must_decay = note->progress % CONST_NOTE_DECAY == 0;
+                if(must_decay)
+                {
+                    note->gain -= 1;
+                    note->gain_setpoint -= 1;
+                }
+            }
+        }
+    }
+    // Note delta ramp - prevents clicks and pops.
+    else
+    {
+        int step = diff / abs(diff);
+        note->gain += step;
+    }
+}
+
+static void
+Note_Process(Note* note)
+{
+    Note_Roll(note);
+    Note_Clamp(note);
+}
+
+static float
+Note_Freq(Note* note)
+{
+    return 440.0f * powf(2.0f, (note->id - 69.0f) / 12.0f);
+}
+
+static float
+Note_Step(Note* note, float progress)
+{
+    float freq = Note_Freq(note);
+    return (progress * (2.0f * CONST_PI) * freq) / CONST_SAMPLE_FREQ;
+}
+
+static void
+Note_Cross(Note* note, int bend, int id)
+{
+    if(!note->was_init)
+    {
+        note->was_init = true;
+        note->id = id;
+    }
+    if(bend != note->bend_last)
+    {
+        note->bend_last = bend;
+        note->wait = true;
+    }
+    // Note frequency can only be changed at axis crossing, so crossings are only looked for while waiting.
+    if(note->wait)
+    {
+        float x0 = Note_Step(note, note->progress - 0.2f);
+        float x1 = Note_Step(note, note->progress + 0.0f);
+        float a = note->gain * sinf(x0);
+        float b = note->gain * sinf(x1);
+        bool crossed = a < 0.0f && b > 0.0f;
+        if(crossed)
+        {
+            float bend_semitones = 12.0f;
+            float bend_id = (bend - CONST_BEND_DEFAULT) / (CONST_BEND_DEFAULT / bend_semitones);
+            note->id = bend_id + id;
+            note->wait = false;
+            note->progress = 0;
+        }
+    }
+}
+
+static float
+Note_Tick(Note* note, int bend, int id)
+{
+    Note_Cross(note, bend, id);
+    float x = Note_Step(note, note->progress);
+    note->progress += 1;
+    return x;
+}
+
+static void
+Note_Skip(Note* note, int bend, int id) // Note_Tick without the waveform.
+{
+    Note_Cross(note, bend, id);
+    note->progress += 1;
+}
+
+static void
+Notes_Setup(Notes* modus)
+{
+    for(int i = 0; i < CONST_CHANNEL_MAX; i++)
+    for(int j = 0; j < CONST_NOTES_MAX; j++)
+    {
+        Note* note = &modus->note[i][j];
+        note->gain = note->gain_setpoint = CONST_MODULATION_GAIN;
+    }
+}
+
+// Band limited shapes correct the naive waveform around each jump with a polynomial
+// step residual (PolyBLEP) and around each kink with its integral (PolyBLAMP).
+
+static float
+Smooth_Wrap(float t)
+{
+    return t - floorf(t);
+}
+
+static float
+Smooth_Blep(float t, float dt) // Residual of a unit step at t = 0.
+{
+    if(t < dt)
+    {
+        float u = t / dt;
+        return -0.5f * (1.0f - u) * (1.0f - u);
+    }
+    if(t > 1.0f - dt)
+    {
+        float u = (t - 1.0f) / dt;
+        return 0.5f * (u + 1.0f) * (u + 1.0f);
+    }
+    return 0.0f;
+}
+
+static float
+Smooth_Blamp(float t, float dt) // Residual of a unit slope change, per sample, at t = 0.
+{
+    if(t < dt)
+    {
+        float u = 1.0f - t / dt;
+        return u * u * u / 6.0f;
+    }
+    if(t > 1.0f - dt)
+    {
+        float u = (t - 1.0f) / dt + 1.0f;
+        return u * u * u / 6.0f;
+    }
+    return 0.0f;
+}
+
+static float
+Smooth_Phase(Wave* wave, Note* note, float fm, float* dt) // Ticks the note once, like the naive shapes.
+{
+    int bend = wave->meta->bend[wave->channel];
+    float x = Note_Tick(note, bend, wave->id);
+    *dt = Note_Freq(note) / CONST_SAMPLE_FREQ;
+    return Smooth_Wrap((x + fm) / (2.0f * CONST_PI));
+}
+
+static float
+Smooth_SNH(Wave* wave, Note* note, float fm)
+{
+    float dt;
+    float p = Smooth_Phase(wave, note, fm, &dt);
+    float y = p < 0.5f ? sinf(2.0f * CONST_PI * p) : 0.0f;
+    return y + 2.0f * CONST_PI * dt * (Smooth_Blamp(p, dt) + Smooth_Blamp(Smooth_Wrap(p + 0.5f), dt));
+}
+
+static float
+Smooth_TRI(Wave* wave, Note* note, float fm, bool half)
+{
+    float dt;
+    float p = Smooth_Phase(wave, note, fm, &dt);
+    float y = p < 0.25f ? 4.0f * p : p < 0.75f ? 2.0f - 4.0f * p : 4.0f * p - 4.0f;
+    if(half)
+        return (y > 0.0f ? y : 0.0f) + 4.0f * dt * (Smooth_Blamp(p, dt)
+            - 2.0f * Smooth_Blamp(Smooth_Wrap(p - 0.25f), dt) + Smooth_Blamp(Smooth_Wrap(p - 0.5f), dt));
+    return y + 8.0f * dt * (Smooth_Blamp(Smooth_Wrap(p - 0.75f), dt) - Smooth_Blamp(Smooth_Wrap(p - 0.25f), dt));
+}
+
+static bool
+Wave_Smooth(Wave* wave)
+{
+    return wave->synth->engine == ENGINE_POLYBLEP && wave->synth->quality < QUALITY_CHEAP;
+}
+
+static bool
+Wave_Cheap(Wave* wave)
+{
+    return wave->synth->quality >= QUALITY_CHEAP;
+}
+
+static float
+Wave_Parabola(float x) // Sine to within 0.001, from two parabolas.
+{
+    x -= 2.0f * CONST_PI * floorf((x + CONST_PI) / (2.0f * CONST_PI));
+    float y = (4.0f / CONST_PI) * x - (4.0f / (CONST_PI * CONST_PI)) * x * fabsf(x);
+    return 0.775f * y + 0.225f * y * fabsf(y);
+}
+
+static int16_t // Sin
+Wave_SIN(Wave* wave, Note* note, float fm)
+{
+    int bend = wave->meta->bend[wave->channel];
+    float x = Note_Tick(note, bend, wave->id);
+    if(Wave_Cheap(wave))
+        return note->gain * Wave_Parabola(x + fm);
+    return note->gain * sinf(x + fm);
+}
+
+static int16_t // Sin Half
+Wave_SNH(Wave* wave, Note* note, float fm)
+{
+    if(Wave_Smooth(wave))
+        return 1.1f * note->gain * Smooth_SNH(wave, note, fm);
+    int16_t amp = Wave_SIN(wave, note, fm);
+    return amp > 0 ? (1.1f * amp) : 0;
+}
+
+static int16_t // Sin Quarter
+Wave_SNQ(Wave* wave, Note* note, float fm)
+{
+    float f = Note_Step(note, note->progress);
+    if(Wave_Smooth(wave))
+    {
+        // The gate edges jump by the gated value, close enough to its value at the edge.
+        float dt = Note_Freq(note) / CONST_SAMPLE_FREQ;
+        float p = Smooth_Wrap(f / (2.0f * CONST_PI));
+        float y = 0.4f * 1.1f * note->gain * Smooth_SNH(wave, note, fm);
+        float gate = p < 0.25f || p >= 0.75f ? y : 0.0f;
+        return gate + y * (Smooth_Blep(Smooth_Wrap(p - 0.75f), dt) - Smooth_Blep(Smooth_Wrap(p - 0.25f), dt));
+    }
+    int16_t x = 0.4f * Wave_SNH(wave, note, fm);
+    return cosf(f) > 0.0f ? x : 0;
+}
+
+static int16_t // Square
+Wave_SQR(Wave* wave, Note* note, float fm)
+{
+    if(Wave_Smooth(wave))
+    {
+        float dt;
+        float p = Smooth_Phase(wave, note, fm, &dt);
+        float y = (p < 0.5f ? 1.0f : -1.0f) + 2.0f * (Smooth_Blep(p, dt) - Smooth_Blep(Smooth_Wrap(p + 0.5f), dt));
+        return note->gain * y / 8.0f;
+    }
+    int16_t amp = Wave_SIN(wave, note, fm);
+    return (amp >= 0 ? note->gain : -note->gain) / 8.0f;
+}
+
+static int16_t // Triangle
+Wave_TRI(Wave* wave, Note* note, float fm)
+{
+    if(Wave_Smooth(wave))
+        return note->gain * Smooth_TRI(wave, note, fm, false) / 3.0f;
+    int bend = wave->meta->bend[wave->channel];
+    float x = Note_Tick(note, bend, wave->id);
+    if(Wave_Cheap(wave))
+    {
+        float p = Smooth_Wrap((x + fm) / (2.0f * CONST_PI));
+        float y = p < 0.25f ? 4.0f * p : p < 0.75f ? 2.0f - 4.0f * p : 4.0f * p - 4.0f;
+        return note->gain * y / 3.0f;
+    }
+    return note->gain * asinf(sinf(x + fm)) / 1.5708f / 3.0f;
+}
+
+static int16_t // Triangle Half
+Wave_TRH(Wave* wave, Note* note, float fm)
+{
+    if(Wave_Smooth(wave))
+        return 1.6f * note->gain * Smooth_TRI(wave, note, fm, true) / 3.0f;
+    int16_t amp = Wave_TRI(wave, note, fm);
+    return amp > 0 ? (1.6f * amp) : 0;
+}
+
+static float
+Flatten(int16_t gain)
+{
+    return gain / (1.0f * CONST_MODULATION_GAIN);
+}
+
+static float
+Wave_GetFMMultiplier(Wave* wave)
+{
+    return (CONST_PI / 8.0f) + (CONST_PI / 4.0f) * wave->bank / (float) CONST_BANK_WIDTH;
+}
+
+static int16_t
+Wave_FM(Wave* wave, Note* note, Signal a, Signal b, float volume)
+{
+    if(wave->synth->quality >= QUALITY_NO_FM)
+        return volume * a(wave, note, 0.0f);
+    float multiplier = Wave_GetFMMultiplier(wave);
+    return volume * a(wave, note, multiplier * Flatten(b(wave, wave->modu, 0.0f)));
+}
+
+static int16_t
+(Wave_Piano)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_SIN, Wave_SIN, 0.7f);
+}
+
+static int16_t
+(Wave_ChromaticPercussion)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.6f);
+}
+
+static int16_t
+(Wave_Organ)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_TRH, Wave_SIN, 0.8f);
+}
+
+static int16_t
+(Wave_SynthLead)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.8f);
+}
+
+static int16_t
+(Wave_SynthPad)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.8f);
+}
+
+static int16_t
+(Wave_SynthEffects)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.8f);
+}
+
+static int16_t
+(Wave_Guitar)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_SNQ, Wave_SIN, 0.6f);
+}
+
+static int16_t
+(Wave_Bass)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_SNH, Wave_SIN, 1.0f);
+}
+
+static int16_t
+(Wave_Pipe)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_SQR, Wave_TRH, 0.7f);
+}
+
+static int16_t
+(Wave_Strings1)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_TRH, Wave_SIN, 0.6f);
+}
+
+static int16_t
+(Wave_Strings2)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_SNH, Wave_TRI, 0.5f);
+}
+
+static int16_t
+(Wave_Brass)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_SQR, Wave_SIN, 0.8f);
+}
+
+static int16_t
+(Wave_Reed)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_SNQ, Wave_SIN, 0.8f);
+}
+
+static int16_t
+(Wave_Ethnic)
+(Wave* wave, Note* note, float fm)
+{
+    (void) fm;
+    return Wave_FM(wave, note, Wave_TRI, Wave_SIN, 0.8f);
+}
+
+static int16_t
+(Wave_Percussive)
+(Wave* wave, Note* note, float fm)
+{
+    (void) wave;
+    (void) note;
+    (void) fm;
+    return 0.0f;
+}
+
+static int16_t
+(Wave_SoundEffects)
+(Wave* wave, Note* note, float fm)
+{
+    (void) wave;
+    (void) note;
+    (void) fm;
+    return 0.0f;
+}
+
+static int16_t
+(* const WAVE_WAVEFORMS[])(Wave* wave, Note* note, float fm) = {
+    [  0 ] = Wave_Piano,
+    [  1 ] = Wave_ChromaticPercussion,
+    [  2 ] = Wave_Organ,
+    [  3 ] = Wave_Guitar,
+    [  4 ] = Wave_Bass,
+    [  5 ] = Wave_Strings1,
+    [  6 ] = Wave_Strings2,
+    [  7 ] = Wave_Brass,
+    [  8 ] = Wave_Reed,
+    [  9 ] = Wave_Pipe,
+    [ 10 ] = Wave_SynthLead,
+    [ 11 ] = Wave_SynthPad,
+    [ 12 ] = Wave_SynthEffects,
+    [ 13 ] = Wave_Ethnic,
+    [ 14 ] = Wave_Percussive,
+    [ 15 ] = Wave_SoundEffects,
+};
+
+// The fixed point engine keeps a full cycle in a 32 bit phase accumulator, so every
+// wrap is a positive zero crossing. Waveform amplitudes are Q15 and volumes Q8.
+
+static void
+Fixed_Init(Fixed* fixed)
+{
+    // Tables are rounded once from double precision, leaving nothing architecture dependent in the render loop.
+    double pi = acos(-1.0);
+    for(int i = 0; i < (1 << CONST_FIXED_SINE_BITS); i++)
+        fixed->sine[i] = lround(32767.0 * sin(2.0 * pi * i / (1 << CONST_FIXED_SINE_BITS)));
+    // Steps for the lowest octave in Q8, shifted up one bit per octave.
+    for(int i = 0; i < 12; i++)
+    {
+        double freq = 440.0 * pow(2.0, (i - CONST_FIXED_PITCH_LOW - 69.0) / 12.0);
+        fixed->semitone[i] = llround(freq / CONST_SAMPLE_FREQ * 4294967296.0 * 256.0);
+    }
+    // Fractions of a semitone in Q31.
+    for(int i = 0; i < (1 << CONST_FIXED_PITCH_BITS); i++)
+        fixed->fine[i] = llround(2147483648.0 * pow(2.0, i / (12.0 * (1 << CONST_FIXED_PITCH_BITS))));
+}
+
+static uint32_t
+Fixed_Step(Fixed* fixed, int pitch) // Pitch in Q12 semitones, which holds every pitch bend exactly.
+{
+    int index = pitch + (CONST_FIXED_PITCH_LOW << CONST_FIXED_PITCH_BITS);
+    if(index < 0)
+        index = 0;
+    int semitones = index >> CONST_FIXED_PITCH_BITS;
+    uint64_t fine = fixed->fine[index & ((1 << CONST_FIXED_PITCH_BITS) - 1)];
+    uint64_t step = fixed->semitone[semitones % 12] * fine >> 31;
+    return (step << (semitones / 12)) >> 8;
+}
+
+static int
+Fixed_Sin(Fixed* fixed, uint32_t phase)
+{
+    return fixed->sine[phase >> (32 - CONST_FIXED_SINE_BITS)];
+}
+
+static int
+Fixed_Tri(uint32_t phase)
+{
+    int32_t x = phase >> 16;
+    if(x < 16384)
+        return 2 * x;
+    if(x < 49152)
+        return 32768 - 2 * (x - 16384);
+    return 2 * (x - 65536);
+}
+
+static uint32_t
+Fixed_Tick(Fixed* fixed, Note* note, int bend, int id)
+{
+    if(!note->was_init)
+    {
+        note->was_init = true;
+        note->pitch = id << CONST_FIXED_PITCH_BITS;
+        note->phase_step = Fixed_Step(fixed, note->pitch);
+    }
+    if(bend != note->bend_last)
+    {
+        note->bend_last = bend;
+        note->wait = true;
+    }
+    // Like Note_Tick, only crossings within the last fifth of a step count.
+    bool crossed = note->phase > 0 && note->phase < note->phase_step / 5;
+    if(crossed && note->wait)
+    {
+        note->pitch = (id << CONST_FIXED_PITCH_BITS) + (bend - CONST_BEND_DEFAULT) * 12 * (1 << CONST_FIXED_PITCH_BITS) / CONST_BEND_DEFAULT;
+        note->phase_step = Fixed_Step(fixed, note->pitch);
+        note->wait = false;
+        note->phase = 0;
+        note->progress = 0;
+    }
+    // Progress still clocks the envelope decay.
+    uint32_t phase = note->phase;
+    note->phase += note->phase_step;
+    note->progress += 1;
+    return phase;
+}
+
+static int16_t // Sin
+Fixed_SIN(Wave* wave, Note* note, uint32_t fm)
+{
+    int bend = wave->meta->bend[wave->channel];
+    uint32_t x = Fixed_Tick(&wave->synth->fixed, note, bend, wave->id);
+    return note->gain * Fixed_Sin(&wave->synth->fixed, x + fm) >> 15;
+}
+
+static int16_t // Sin Half
+Fixed_SNH(Wave* wave, Note* note, uint32_t fm)
+{
+    int16_t amp = Fixed_SIN(wave, note, fm);
+    return amp > 0 ? (282 * amp) >> 8 : 0;
+}
+
+static int16_t // Sin Quarter
+Fixed_SNQ(Wave* wave, Note* note, uint32_t fm)
+{
+    uint32_t quarter = note->phase >> 30;
+    int16_t x = (102 * Fixed_SNH(wave, note, fm)) >> 8;
+    return quarter == 0 || quarter == 3 ? x : 0;
+}
+
+static int16_t // Square
+Fixed_SQR(Wave* wave, Note* note, uint32_t fm)
+{
+    int16_t amp = Fixed_SIN(wave, note, fm);
+    return (amp >= 0 ? note->gain : -note->gain) / 8;
+}
+
+static int16_t // Triangle
+Fixed_TRI(Wave* wave, Note* note, uint32_t fm)
+{
+    int bend = wave->meta->bend[wave->channel];
+    uint32_t x = Fixed_Tick(&wave->synth->fixed, note, bend, wave->id);
+    return (note->gain * Fixed_Tri(x + fm) / 3) >> 15;
+}
+
+static int16_t // Triangle Half
+Fixed_TRH(Wave* wave, Note* note, uint32_t fm)
+{
+    int16_t amp = Fixed_TRI(wave, note, fm);
+    return amp > 0 ? (410 * amp) >> 8 : 0;
+}
+
+static const Instrument FIXED_INSTRUMENTS[] = {
+    [  0 ] = { Fixed_SIN, Fixed_SIN, 179 }, // Piano.
+    [  1 ] = { Fixed_TRI, Fixed_SIN, 154 }, // Chromatic Percussion.
+    [  2 ] = { Fixed_TRH, Fixed_SIN, 205 }, // Organ.
+    [  3 ] = { Fixed_SNQ, Fixed_SIN, 154 }, // Guitar.
+    [  4 ] = { Fixed_SNH, Fixed_SIN, 256 }, // Bass.
+    [  5 ] = { Fixed_TRH, Fixed_SIN, 154 }, // Strings 1.
+    [  6 ] = { Fixed_SNH, Fixed_TRI, 128 }, // Strings 2.
+    [  7 ] = { Fixed_SQR, Fixed_SIN, 205 }, // Brass.
+    [  8 ] = { Fixed_SNQ, Fixed_SIN, 205 }, // Reed.
+    [  9 ] = { Fixed_SQR, Fixed_TRH, 179 }, // Pipe.
+    [ 10 ] = { Fixed_TRI, Fixed_SIN, 205 }, // Synth Lead.
+    [ 11 ] = { Fixed_TRI, Fixed_SIN, 205 }, // Synth Pad.
+    [ 12 ] = { Fixed_TRI, Fixed_SIN, 205 }, // Synth Effects.
+    [ 13 ] = { Fixed_TRI, Fixed_SIN, 205 }, // Ethnic.
+    [ 14 ] = { NULL, NULL, 0 }, // Percussive.
+    [ 15 ] = { NULL, NULL, 0 }, // Sound Effects.
+};
+
+static int16_t
+Fixed_Wave(Wave* wave, Note* note)
+{
+    const Instrument* instrument = &FIXED_INSTRUMENTS[wave->bank];
+    if(instrument->carrier == NULL)
+        return 0;
+    // FM index in Q16 cycles: (pi / 8 + pi / 4 * bank / width) / (2 * pi).
+    if(wave->synth->quality >= QUALITY_NO_FM)
+        return (instrument->volume * instrument->carrier(wave, note, 0)) >> 8;
+    int32_t index = 4096 + 8192 * wave->bank / CONST_BANK_WIDTH;
+    int32_t modulation = instrument->modulator(wave, wave->modu, 0);
+    // Modulation is Q9 against CONST_MODULATION_GAIN, leaving 32 - 9 - 16 bits to reach a full cycle.
+    uint32_t fm = (uint32_t) (modulation * index) << 7;
+    return (instrument->volume * instrument->carrier(wave, note, fm)) >> 8;
+}
+
+static Synth
+Synth_Init(Engine engine)
+{
+    Synth synth = { 0 };
+    synth.engine = engine;
+    Fixed_Init(&synth.fixed);
+    return synth;
+}
+
+static void
+Track_Free(Track* track)
+{
+    free(track->data);
+    track->data = NULL;
+}
+
+static void
+Track_Back(Track* track)
+{
+    track->index -= 1;
+}
+
+static void
+Track_Next(Track* track)
+{
+    track->index += 1;
+}
+
+static void
+Track_Crash(Track* track)
+{
+    // The library never exits: every parse runs under a crash target, which finds the failing track flagged.
+    // Streamed playback keeps one too, as the file can change on disk after its checked parse.
+    track->crashed = true;
+    if(track->crash)
+        longjmp(*track->crash, 1);
+    abort();
+}
+
+static void
+Track_Fill(Track* track) // Slides the stream window over the byte at the track index.
+{
+    if(track->file == NULL || track->index >= track->size)
+        Track_Crash(track);
+    uint32_t count = track->size - track->index;
+    if(count > CONST_TRACK_WINDOW)
+        count = CONST_TRACK_WINDOW;
+    fseek(track->file, track->offset + track->index, SEEK_SET);
+    track->count = fread(track->data, sizeof(*track->data), count, track->file);
+    track->start = track->index;
+    if(track->count == 0)
+        Track_Crash(track);
+}
+
+static uint8_t
+Track_U8(Track* track)
+{
+    if(track->index - track->start >= track->count)
+        Track_Fill(track);
+    uint8_t byte = track->data[track->index - track->start];
+    Track_Next(track);
+    return byte;
+}
+
+static void
+Track_Spin(Track* track, uint32_t size)
+{
+    // Skipped payloads are never read - streamed tracks refill past them.
+    // Checked against the bytes left, as adding a declared length near 4 GiB would wrap the index.
+    if(size > track->size - track->index)
+        Track_Crash(track);
+    track->index += size;
+}
+
+static uint32_t
+Track_Var(Track* track)
+{
+    uint32_t var = 0x0;
+    bool run = true;
+    while(run)
+    {
+        uint8_t byte = Track_U8(track);
+        var = (var << 7) | (byte & 0x7F);
+        run = byte >> 7;
+    }
+    return var;
+}
+
+static uint8_t
+Track_Status(Track* track, uint8_t leader)
+{
+    // Running status keeps the whole status byte, channel included.
+    if(leader >> 7)
+    {
+        track->running_status = leader;
+        return leader;
+    }
+    else
+    {
+        Track_Back(track);
+        return track->running_status;
+    }
+}
+
+static bool
+IsPercussive(uint8_t channel)
+{
+    return channel == 9;
+}
+
+static void
+Message_Apply(Message* message, Meta* meta, Notes* notes)
+{
+    // Data bytes index the notes and banks, so anything past seven bits is dropped here too.
+    if((message->a | message->b) >> 7)
+        return;
+    uint8_t channel = message->leader & 0xF;
+    uint8_t status = message->leader >> 4;
+    switch(status)
+    {
+        default:
+        {
+            break;
+        }
+        // Note Off.
+        case 0x8:
+        {
+            if(!IsPercussive(channel))
+            {
+                Note* note = &notes->note[channel][message->a];
+                note->gain_setpoint = 0;
+                meta->bend[channel] = CONST_BEND_DEFAULT;
+            }
+            break;
+        }
+        // Note On.
+        case 0x9:
+        {
+            if(!IsPercussive(channel))
+            {
+                Note* note = &notes->note[channel][message->a];
+                note->gain_setpoint = CONST_NOTE_ATTACK * message->b * meta->volume[channel] / 127;
+                note->on = true;
+                meta->bend[channel] = CONST_BEND_DEFAULT;
+            }
+            break;
+        }
+        // Note Aftertouch.
+        case 0xA:
+        {
+            break;
+        }
+        // Controller.
+        case 0xB:
+        {
+            switch(message->a)
+            {
+                case 0x07:
+                    meta->volume[channel] = message->b;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        // Program Change.
+        case 0xC:
+        {
+            meta->instruments[channel] = message->a;
+            break;
+        }
+        // Channel Aftertouch.
+        case 0xD:
+        {
+            break;
+        }
+        // Pitch Bend.
+        case 0xE:
+        {
+            uint16_t bend = (message->b << 7) | message->a;
+            meta->bend[channel] = bend;
+            break;
+        }
+    }
+}
+
+static uint8_t
+Message_Size(uint8_t leader)
+{
+    uint8_t status = leader >> 4;
+    return status == 0xC || status == 0xD ? 1 : 2;
+}
+
+static void
+Events_Push(Events* events, uint64_t tick, Message* message)
+{
+    if(events->count == events->max)
+    {
+        events->max = events->max == 0 ? 1024 : 2 * events->max;
+        events->event = realloc(events->event, events->max * sizeof(*events->event));
+    }
+    events->event[events->count++] = (Event) { tick, message->leader, message->a, message->b, { 0 } };
+}
+
+static void
+Track_RealEvent(Track* track, Meta* meta, Notes* notes, uint8_t leader)
+{
+    Message message = { Track_Status(track, leader), 0, 0 };
+    uint8_t status = message.leader >> 4;
+    if(status < 0x8 || status > 0xE)
+        Track_Crash(track);
+    message.a = Track_U8(track);
+    if(Message_Size(message.leader) == 2)
+        message.b = Track_U8(track);
+    // A status byte where data belongs is a corrupt file, not a note past 127.
+    if((message.a | message.b) >> 7)
+        Track_Crash(track);
+    if(track->record)
+        Events_Push(track->record, track->tick, &message);
+    Message_Apply(&message, meta, notes);
+}
+
+static void
+Track_MetaEvent(Track* track, Meta* meta)
+{
+    switch(Track_U8(track))
+    {
+        default:
+        {
+            Track_Crash(track);
+            break;
+        }
+        // Sequence Number.
+        case 0x00:
+        {
+            Track_Spin(track, 3);
+            break;
+        }
+        case 0x01: // Text Event.
+        case 0x02: // Copyright Notice.
+        case 0x03: // Track Name.
+        case 0x04: // Instrument Name.
+        case 0x05: // Lyric.
+        case 0x06: // Marker.
+        case 0x07: // Cue Point.
+        case 0x08: // Program Name.
+        case 0x09: // Device Name.
+        {
+            Track_Spin(track, Track_Var(track));
+            break;
+        }
+        // Channel Prefix.
+        case 0x20:
+        {
+            Track_Spin(track, 2);
+            break;
+        }
+        // Midi Port.
+        case 0x21:
+        {
+            Track_Spin(track, 2);
+            break;
+        }
+        // End of Track.
+        case 0x2F:
+        {
+            track->run = Track_U8(track);
+            break;
+        }
+        // Tempo.
+        case 0x51:
+        {
+            Track_U8(track);
+            uint8_t a = Track_U8(track);
+            uint8_t b = Track_U8(track);
+            uint8_t c = Track_U8(track);
+            meta->tempo = (a << 16) | (b << 8) | c;
+            break;
+        }
+        // SMPTE Offset.
+        case 0X54:
+        {
+            Track_Spin(track, 6);
+            break;
+        }
+        // Time Signature.
+        case 0x58:
+        {
+            Track_Spin(track, 5);
+            break;
+        }
+        // Key Signature.
+        case 0x59:
+        {
+            Track_Spin(track, 3);
+            break;
+        }
+        case 0xF0: // Sysex Start.
+        case 0xF7: // Sysex End.
+        case 0x7F: // Systex Running Status.
+        {
+            Track_Spin(track, Track_Var(track));
+            break;
+        }
+    }
+}
+
+static void
+Track_Event(Track* track, Notes* notes, Meta* meta)
+{
+    uint8_t leader = Track_U8(track);
+    switch(leader)
+    {
+        case 0xFF:
+            Track_MetaEvent(track, meta);
+            break;
+        case 0xF0: // Sysex.
+        case 0xF7: // Sysex Escape.
+            Track_Spin(track, Track_Var(track));
+            break;
+        default:
+            Track_RealEvent(track, meta, notes, leader);
+            break;
+    }
+    track->events += 1;
+}
+
+static void
+Track_Play(Track* track, Notes* notes, Meta* meta)
+{
+    // Notes with zero delay must immediately process
+    // the next note before moving onto the next track.
+    uint32_t delay = 0;
+    do
+    {
+        Track_Event(track, notes, meta);
+        if(track->run)
+        {
+            delay = Track_Var(track);
+            track->tick += delay;
+        }
+    }
+    while(track->run && delay == 0);
+}
+
+static Track
+Track_Init(Bytes* bytes, uint32_t offset, uint32_t number)
+{
+    Track track = { 0 };
+    track.id = Bytes_U32(bytes, offset);
+    track.size = Bytes_U32(bytes, offset + 4);
+    track.data = calloc(track.size, sizeof(*track.data));
+    track.count = track.size;
+    track.run = true;
+    track.number = number;
+    for(uint32_t i = 0; i < track.size; i++)
+        track.data[i] = Bytes_U8(bytes, offset + 8 + i);
+    return track;
+}
+
+static void
+Track_Rewind(Track* track)
+{
+    track->index = 0;
+    track->tick = 0;
+    track->events = 0;
+    track->running_status = 0;
+    track->run = true;
+    if(track->file)
+        track->count = 0;
+}
+
+static void
+Audio_LimitFloat(int32_t* bus, uint32_t frames)
+{
+    // Linear up to the knee, then a soft curve that approaches the ceiling without reaching it.
+    // Only single rounding operations are used, so every build limits to the same samples.
+    const float knee = CONST_LIMIT_KNEE;
+    const float ceiling = CONST_LIMIT_CEILING;
+    const float range = ceiling - knee;
+    for(uint32_t frame = 0; frame < frames; frame++)
+    {
+        float x = (float) (bus[frame] * CONST_NOTE_AMPLIFICATION);
+        float level = fabsf(x);
+        float over = fmaxf(level - knee, 0.0f);
+        float soft = ceiling - range * range / (range + over);
+        bus[frame] = (int32_t) copysignf(fminf(level, soft), x);
+    }
+}
+
+static void
+Audio_LimitFixed(int32_t* bus, uint32_t frames)
+{
+    // The same curve in integers, keeping the fixed point engine bit exact on every target.
+    const int64_t range = CONST_LIMIT_CEILING - CONST_LIMIT_KNEE;
+    for(uint32_t frame = 0; frame < frames; frame++)
+    {
+        int32_t x = bus[frame] * CONST_NOTE_AMPLIFICATION;
+        int32_t level = x < 0 ? -x : x;
+        if(level > CONST_LIMIT_KNEE)
+            level = CONST_LIMIT_CEILING - range * range / (range + level - CONST_LIMIT_KNEE);
+        bus[frame] = x < 0 ? -level : level;
+    }
+}
+
+static void
+Audio_Limit(int32_t* bus, int16_t* mixes, uint32_t frames, uint32_t channels, Engine engine)
+{
+    if(engine == ENGINE_FIXED)
+        Audio_LimitFixed(bus, frames);
+    else
+        Audio_LimitFloat(bus, frames);
+    // Converted once per block, every speaker slot of a frame in one store.
+    if(channels == 2)
+        for(uint32_t frame = 0; frame < frames; frame++)
+            mixes[2 * frame + 0] = mixes[2 * frame + 1] = bus[frame];
+    else
+        for(uint32_t frame = 0; frame < frames; frame++)
+            for(uint32_t speaker = 0; speaker < channels; speaker++)
+                mixes[frame * channels + speaker] = bus[frame];
+}
+
+static uint64_t
+Audio_Voices(Notes* notes, Notes* modus, Meta* meta, int32_t* buses, uint32_t stride, const uint8_t route[], uint32_t count, uint32_t frames, Synth* synth)
+{
+    // The one voice loop. Each channel sums onto the bus route names, out of count buses laid out planar,
+    // stride frames apart. Buses hold raw sums for the caller to limit.
+    uint64_t voices = 0;
+    uint32_t cap = synth->quality >= QUALITY_CAPPED ? CONST_QUALITY_VOICES : UINT32_MAX;
+    for(uint32_t frame = 0; frame < frames; frame++)
+    {
+        int32_t part[CONST_CHANNEL_MAX] = { 0 };
+        uint32_t heard = 0;
+        for(uint32_t note_index = 0; note_index < CONST_NOTES_MAX; note_index++)
+        {
+            for(uint8_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+            {
+                Note* note = &notes->note[channel][note_index];
+                Note* modu = &modus->note[channel][note_index];
+                if(note->on)
+                {
+                    Note_Process(note);
+                    Note_Process(modu);
+                    bool audible = note->gain > 0;
+                    if(audible && heard < cap)
+                    {
+                        int bank = Meta_GetBank(meta, channel);
+                        Wave wave = { modu, meta, channel, note_index, bank, synth };
+                        if(synth->engine == ENGINE_FIXED)
+                            part[route[channel]] += Fixed_Wave(&wave, note);
+                        else
+                            part[route[channel]] += WAVE_WAVEFORMS[bank](&wave, note, 0.0f);
+                        voices += 1;
+                        heard += 1;
+                    }
+                }
+            }
+        }
+        for(uint32_t bus = 0; bus < count; bus++)
+            buses[bus * stride + frame] = part[bus];
+    }
+    return voices;
+}
+
+static uint64_t
+Audio_Mix(Notes* notes, Notes* modus, Meta* meta, int16_t* mixes, uint32_t samples, uint32_t channels, Synth* synth)
+{
+    // Voices sum on a 32-bit bus, so dense passages are limited instead of wrapping around.
+    static const uint8_t route[CONST_CHANNEL_MAX] = { 0 };
+    int32_t bus[CONST_BUS_FRAMES];
+    uint64_t voices = 0;
+    uint32_t frames = samples / channels;
+    for(uint32_t first = 0; first < frames; first += CONST_BUS_FRAMES)
+    {
+        uint32_t count = frames - first < CONST_BUS_FRAMES ? frames - first : CONST_BUS_FRAMES;
+        voices += Audio_Voices(notes, modus, meta, bus, CONST_BUS_FRAMES, route, 1, count, synth);
+        Audio_Limit(bus, &mixes[first * channels], count, channels, synth->engine);
+    }
+    return voices;
+}
+
+static void
+Audio_Skip(Notes* notes, Notes* modus, Meta* meta, uint64_t frames, Synth* synth)
+{
+    // Advances voice state exactly as Audio_Mix would, without synthesizing. No events
+    // land inside a skip, so only voices that are on now can be touched.
+    uint16_t active[CONST_CHANNEL_MAX * CONST_NOTES_MAX];
+    uint32_t count = 0;
+    for(uint32_t note_index = 0; note_index < CONST_NOTES_MAX; note_index++)
+        for(uint8_t channel = 0; channel < CONST_CHANNEL_MAX; channel++)
+            if(notes->note[channel][note_index].on)
+                active[count++] = channel * CONST_NOTES_MAX + note_index;
+    for(uint64_t frame = 0; frame < frames; frame++)
+    {
+        for(uint32_t i = 0; i < count; i++)
+        {
+            uint8_t channel = active[i] / CONST_NOTES_MAX;
+            uint32_t note_index = active[i] % CONST_NOTES_MAX;
+            Note* note = &notes->note[channel][note_index];
+            Note* modu = &modus->note[channel][note_index];
+            if(note->on)
+            {
+                Note_Process(note);
+                Note_Process(modu);
+                int bank = Meta_GetBank(meta, channel);
+                // Silent banks never tick their notes.
+                if(note->gain > 0 && FIXED_INSTRUMENTS[bank].carrier)
+                {
+                    int bend = meta->bend[channel];
+                    if(synth->engine == ENGINE_FIXED)
+                    {
+                        Fixed_Tick(&synth->fixed, modu, bend, note_index);
+                        Fixed_Tick(&synth->fixed, note, bend, note_index);
+                    }
+                    else
+                    {
+                        Note_Skip(modu, bend, note_index);
+                        Note_Skip(note, bend, note_index);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static Midi
+Midi_Header(Bytes* bytes)
+{
+    Midi midi = { 0 };
+    midi.id = Bytes_U32(bytes, 0);
+    midi.size = Bytes_U32(bytes, 4);
+    midi.format_type = Bytes_U16(bytes, 8);
+    midi.track_count = Bytes_U16(bytes, 10);
+    midi.time_division = Bytes_U16(bytes, 12);
+    midi.track = calloc(midi.track_count, sizeof(*midi.track));
+    midi.heap = calloc(midi.track_count, sizeof(*midi.heap));
+    return midi;
+}
+
+static void
+Midi_Free(Midi* midi)
+{
+    for(uint32_t number = 0; number < midi->track_count; number++)
+        Track_Free(&midi->track[number]);
+    free(midi->track);
+    free(midi->tempos.tempo);
+    free(midi->heap);
+    midi->track = NULL;
+    midi->heap = NULL;
+    midi->tempos.tempo = NULL;
+}
+
+static bool
+Midi_Done(Midi* midi)
+{
+    return midi->events ? midi->event_index == midi->event_count : midi->heap_count == 0;
+}
+
+static bool
+Midi_HeapLess(Midi* midi, uint32_t a, uint32_t b)
+{
+    // Tracks sharing a tick play in track order.
+    Track* x = &midi->track[midi->heap[a]];
+    Track* y = &midi->track[midi->heap[b]];
+    return x->tick < y->tick || (x->tick == y->tick && x->number < y->number);
+}
+
+static void
+Midi_HeapSwap(Midi* midi, uint32_t a, uint32_t b)
+{
+    uint32_t temp = midi->heap[a];
+    midi->heap[a] = midi->heap[b];
+    midi->heap[b] = temp;
+}
+
+static void
+Midi_HeapUp(Midi* midi, uint32_t i)
+{
+    while(i > 0 && Midi_HeapLess(midi, i, (i - 1) / 2))
+    {
+        Midi_HeapSwap(midi, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void
+Midi_HeapDown(Midi* midi, uint32_t i)
+{
+    while(true)
+    {
+        uint32_t min = i;
+        uint32_t l = 2 * i + 1;
+        uint32_t r = 2 * i + 2;
+        if(l < midi->heap_count && Midi_HeapLess(midi, l, min))
+            min = l;
+        if(r < midi->heap_count && Midi_HeapLess(midi, r, min))
+            min = r;
+        if(min == i)
+            break;
+        Midi_HeapSwap(midi, i, min);
+        i = min;
+    }
+}
+
+static void
+Midi_Schedule(Midi* midi) // Reads the first delay of every track.
+{
+    // The heap is sized once in Midi_Header, so seeking never allocates.
+    midi->heap_count = 0;
+    midi->tick = 0;
+    for(uint32_t i = 0; i < midi->track_count; i++)
+    {
+        Track* track = &midi->track[i];
+        track->tick = Track_Var(track);
+        midi->heap[midi->heap_count] = i;
+        Midi_HeapUp(midi, midi->heap_count++);
+    }
+}
+
+static uint32_t
+Midi_Replay(Midi* midi, Notes* notes, Meta* meta) // Midi_Step over a precompiled event array.
+{
+    while(midi->event_index < midi->event_count && midi->events[midi->event_index].tick == midi->tick)
+    {
+        Event* event = &midi->events[midi->event_index++];
+        Message message = { event->leader, event->a, event->b };
+        Message_Apply(&message, meta, notes);
+    }
+    if(Midi_Done(midi))
+        return 0;
+    uint64_t tick = midi->events[midi->event_index].tick;
+    uint32_t ticks = tick - midi->tick;
+    midi->tick = tick;
+    return ticks;
+}
+
+static uint32_t
+Midi_Step(Midi* midi, Notes* notes, Meta* meta)
+{
+    if(midi->events)
+        return Midi_Replay(midi, notes, meta);
+    // Only tracks with events at this tick are touched; finished tracks leave the heap.
+    while(midi->heap_count > 0)
+    {
+        Track* track = &midi->track[midi->heap[0]];
+        if(track->tick != midi->tick)
+            break;
+        Track_Play(track, notes, meta);
+        if(!track->run)
+            midi->heap[0] = midi->heap[--midi->heap_count];
+        Midi_HeapDown(midi, 0);
+    }
+    if(Midi_Done(midi))
+        return 0;
+    uint64_t tick = midi->track[midi->heap[0]].tick;
+    uint32_t ticks = tick - midi->tick;
+    midi->tick = tick;
+    return ticks;
+}
+
+static void
+Midi_Rewind(Midi* midi)
+{
+    midi->event_index = 0;
+    for(uint32_t i = 0; i < midi->track_count; i++)
+        Track_Rewind(&midi->track[i]);
+    Midi_Schedule(midi);
+}
+
+static void
+Tempos_Push(Tempos* tempos, uint64_t tick, uint32_t rate)
+{
+    Tempo* last = &tempos->tempo[tempos->count - 1];
+    if(last->tick == tick)
+        last->rate = rate;
+    else
+    {
+        Tempo tempo = { tick, last->time + (tick - last->tick) * last->rate, rate, 0 };
+        tempos->tempo = realloc(tempos->tempo, (tempos->count + 1) * sizeof(*tempos->tempo));
+        tempos->tempo[tempos->count++] = tempo;
+    }
+}
+
+static Tempos
+Tempos_Init(Midi* midi)
+{
+    // Time is kept as ticks scaled by rate, so seconds are exactly time / scale.
+    // Midi_Division has vetted the time division, so scale is never zero.
+    Tempos tempos = { 0 };
+    tempos.tempo = calloc(1, sizeof(*tempos.tempo));
+    tempos.count = 1;
+    bool use_ticks = (midi->time_division & 0x8000) == 0;
+    if(use_ticks)
+    {
+        tempos.scale = midi->time_division * UINT64_C(1000000);
+        tempos.tempo[0].rate = CONST_TEMPO_DEFAULT;
+    }
+    // Frames Per Second.
+    else
+    {
+        uint64_t fps = -(int8_t) (midi->time_division >> 8);
+        uint64_t ticks_per_frame = midi->time_division & 0xFF;
+        bool drop_frame = fps == 29;
+        tempos.scale = (drop_frame ? 30000 : 1000 * fps) * ticks_per_frame;
+        tempos.tempo[0].rate = drop_frame ? 1001 : 1000;
+    }
+    return tempos;
+}
+
+static uint64_t
+Tempos_Sample(Tempos* tempos, uint64_t tick)
+{
+    uint32_t lo = 0;
+    uint32_t hi = tempos->count;
+    while(hi - lo > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if(tempos->tempo[mid].tick <= tick)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    Tempo* tempo = &tempos->tempo[lo];
+    uint64_t time = tempo->time + (tick - tempo->tick) * tempo->rate;
+    uint64_t seconds = time / tempos->scale;
+    uint64_t rest = time % tempos->scale;
+    return seconds * CONST_SAMPLE_FREQ + rest * CONST_SAMPLE_FREQ / tempos->scale;
+}
+
+static void
+Midi_Map(Midi* midi, Notes* notes) // Dry run collecting every tempo change, then rewinds. Notes are scratch.
+{
+    midi->tempos = Tempos_Init(midi);
+    bool use_ticks = (midi->time_division & 0x8000) == 0;
+    Meta meta = { 0 };
+    meta.tempo = CONST_TEMPO_DEFAULT;
+    uint64_t tick = 0;
+    while(true)
+    {
+        uint32_t ticks = Midi_Step(midi, notes, &meta);
+        if(use_ticks && meta.tempo != midi->tempos.tempo[midi->tempos.count - 1].rate)
+            Tempos_Push(&midi->tempos, tick, meta.tempo);
+        if(Midi_Done(midi))
+            break;
+        tick += ticks;
+    }
+    midi->ticks = tick;
+    Midi_Rewind(midi);
+}
+
+static void
+Midi_Load(Midi* midi, Bytes* bytes, Notes* notes, jmp_buf* crash) // Malformed events longjmp to crash.
+{
+    // Fills a midi from Midi_Header in place, so a crash leaves everything reachable for Midi_Free.
+    uint32_t offset = 14;
+    for(uint32_t number = 0; number < midi->track_count; number++)
+    {
+        if(number > 0)
+        {
+            offset += 8;
+            offset += midi->track[number - 1].size;
+        }
+        midi->track[number] = Track_Init(bytes, offset, number);
+        midi->track[number].crash = crash;
+    }
+    Midi_Schedule(midi);
+    Midi_Map(midi, notes);
+}
+
+static bool
+Render_Run(Render* render, uint64_t end, int16_t* pcm, FILE* out, bool skip)
+{
+    // Offline, events land on exact sample frames instead of audio block boundaries.
+    // Frames go straight into pcm when given, else through a chunk written to out.
+    int16_t chunk[CONST_RENDER_SAMPLES];
+    uint64_t start = render->frame;
+    while(render->frame < end && !render->done)
+    {
+        if(render->frame == render->target)
+        {
+            Midi_Step(render->midi, render->notes, render->meta);
+            render->done = Midi_Done(render->midi);
+            render->target = Tempos_Sample(&render->midi->tempos, render->midi->tick);
+            continue;
+        }
+        uint64_t count = (render->target < end ? render->target : end) - render->frame;
+        if(pcm == NULL && count > CONST_RENDER_SAMPLES / render->channels)
+            count = CONST_RENDER_SAMPLES / render->channels;
+        if(skip)
+            Audio_Skip(render->notes, render->modus, render->meta, count, render->synth);
+        else
+        {
+            int16_t* mixes = pcm ? &pcm[(render->frame - start) * render->channels] : chunk;
+            render->voices += Audio_Mix(render->notes, render->modus, render->meta, mixes, count * render->channels, render->channels, render->synth);
+            if(out && fwrite(mixes, sizeof(*mixes), count * render->channels, out) != count * render->channels)
+                return false;
+        }
+        render->frame += count;
+    }
+    return true;
+}
+
+static bool
+Midi_Division(uint16_t time_division) // False when the tempo map would have a zero scale.
+{
+    return (time_division & 0x7FFF) != 0 && ((time_division & 0x8000) == 0 || (time_division & 0xFF) != 0);
+}
+
+static bool
+Midi_Check(Bytes* bytes) // Validates chunk layout so untrusted files cannot be read out of bounds.
+{
+    if(bytes->size < 14 || Bytes_U32(bytes, 0) != 0x4D546864 || !Midi_Division(Bytes_U16(bytes, 12)))
+        return false;
+    uint64_t offset = 14;
+    for(uint32_t number = 0; number < Bytes_U16(bytes, 10); number++)
+    {
+        if(offset + 8 > bytes->size || Bytes_U32(bytes, offset) != 0x4D54726B)
+            return false;
+        offset += 8 + (uint64_t) Bytes_U32(bytes, offset + 4);
+        if(offset > bytes->size)
+            return false;
+    }
+    return true;
+}
+struct Minimidi
+{
+    Midi midi;
+    Notes notes;
+    Notes modus;
+    Meta meta;
+    Synth synth;
+    Render render;
+    jmp_buf crash;
+};
+
+static void
+Minimidi_Rewind(Minimidi* minimidi)
+{
+    Midi_Rewind(&minimidi->midi);
+    memset(&minimidi->notes, 0, sizeof(minimidi->notes));
+    memset(&minimidi->modus, 0, sizeof(minimidi->modus));
+    Notes_Setup(&minimidi->modus);
+    minimidi->meta = (Meta) { 0 };
+    minimidi->render.frame = 0;
+    minimidi->render.target = 0;
+    minimidi->render.voices = 0;
+    minimidi->render.done = false;
+}
+
+static bool
+Minimidi_Parse(Minimidi* minimidi, Bytes* bytes)
+{
+    // The full parse at load is the only one that can fail, so later calls never need recovery.
+    if(setjmp(minimidi->crash))
+        return false;
+    Midi_Load(&minimidi->midi, bytes, &minimidi->notes, &minimidi->crash);
+    return true;
+}
+
+Minimidi*
+Minimidi_Load(const void* data, uint32_t size, int engine, uint32_t channels)
+{
+    // Track data is copied, so the caller may release data once this returns.
+    Bytes bytes = { (uint8_t*) data, size };
+    if(!Midi_Check(&bytes) || channels == 0 || channels > MINIMIDI_CHANNELS_MAX || engine < MINIMIDI_ENGINE_FLOAT || engine > MINIMIDI_ENGINE_POLYBLEP)
+        return NULL;
+    Minimidi* minimidi = calloc(1, sizeof(*minimidi));
+    if(minimidi == NULL)
+        return NULL;
+    minimidi->midi = Midi_Header(&bytes);
+    if(!Minimidi_Parse(minimidi, &bytes))
+    {
+        Midi_Free(&minimidi->midi);
+        free(minimidi);
+        return NULL;
+    }
+    minimidi->synth = Synth_Init(engine);
+    Render render = { &minimidi->midi, &minimidi->notes, &minimidi->modus, &minimidi->meta, channels, &minimidi->synth, 0, 0, 0, false };
+    minimidi->render = render;
+    Minimidi_Rewind(minimidi);
+    return minimidi;
+}
+
+void
+Minimidi_Free(Minimidi* minimidi)
+{
+    if(minimidi == NULL)
+        return;
+    Midi_Free(&minimidi->midi);
+    free(minimidi);
+}
+
+uint32_t
+Minimidi_Render(Minimidi* minimidi, int16_t* out, uint32_t frames)
+{
+    uint64_t start = minimidi->render.frame;
+    Render_Run(&minimidi->render, start + frames, out, NULL, false);
+    return minimidi->render.frame - start;
+}
+
+void
+Minimidi_Seek(Minimidi* minimidi, uint64_t frame)
+{
+    // Voices carry state from every earlier frame, so the song replays up to frame without synthesis.
+    Minimidi_Rewind(minimidi);
+    Render_Run(&minimidi->render, frame, NULL, NULL, true);
+}
+
+void
+Minimidi_Send(Minimidi* minimidi, uint8_t status, uint8_t a, uint8_t b)
+{
+    // Only channel messages with seven bit data apply; b is ignored for one data byte messages.
+    if(status < 0x80 || status >= 0xF0)
+        return;
+    if(Message_Size(status) == 1)
+        b = 0;
+    if((a | b) >> 7)
+        return;
+    Message message = { status, a, b };
+    Message_Apply(&message, &minimidi->meta, &minimidi->notes);
+}
+
+uint64_t
+Minimidi_Tell(Minimidi* minimidi)
+{
+    return minimidi->render.frame;
+}
+
+uint64_t
+Minimidi_Length(Minimidi* minimidi)
+{
+    return Tempos_Sample(&minimidi->midi.tempos, minimidi->midi.ticks);
+}
@@ -0,0 +1,49 @@
+#ifndef MINIMIDI_H
+#define MINIMIDI_H
+
+#include <stdint.h>
+
+// Embeddable synth. Each context owns its song, voices and tables, so contexts
+// render independently on any thread. Only Minimidi_Load and Minimidi_Free
+// allocate; render, seek and send are safe on a real-time audio thread.
+
+typedef struct Minimidi Minimidi;
+
+// Engines for Minimidi_Load. Prefixed apart from the player's -DMINIMIDI_FIXED build switch.
+enum
+{
+    MINIMIDI_ENGINE_FLOAT,
+    MINIMIDI_ENGINE_FIXED,
+    MINIMIDI_ENGINE_POLYBLEP,
+};
+
+#define MINIMIDI_SAMPLE_FREQ (44100)
+
+// Interleaved channels per frame, each carrying the same mono mix.
+#define MINIMIDI_CHANNELS_MAX (8)
+
+// Parses a standard MIDI file. The data may be released once this returns.
+// Returns NULL for malformed files, unknown engines, and channel counts
+// outside 1 to MINIMIDI_CHANNELS_MAX.
+Minimidi* Minimidi_Load(const void* data, uint32_t size, int engine, uint32_t channels);
+
+void Minimidi_Free(Minimidi* minimidi);
+
+// Writes up to frames of interleaved 16 bit PCM into out. Returns frames
+// written, fewer than asked only once the song has ended.
+uint32_t Minimidi_Render(Minimidi* minimidi, int16_t* out, uint32_t frames);
+
+// Moves the playhead to an exact frame. Costs a synthesis free pass over the
+// song up to frame, and drops voices started by Minimidi_Send.
+void Minimidi_Seek(Minimidi* minimidi, uint64_t frame);
+
+// Applies a channel message (note on and off, volume, program, pitch bend)
+// from the next rendered frame on. Other statuses and data bytes above 0x7F
+// are ignored.
+void Minimidi_Send(Minimidi* minimidi, uint8_t status, uint8_t a, uint8_t b);
+
+uint64_t Minimidi_Tell(Minimidi* minimidi);
+
+uint64_t Minimidi_Length(Minimidi* minimidi);
+
+#endif